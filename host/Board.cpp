@@ -0,0 +1,419 @@
+#include "Board.h"
+#include "Sim.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+#include <algorithm>
+
+#include <unistd.h>
+#include <fcntl.h>
+
+#include "App.h"
+#include "Pinout.h"
+
+/*
+ * Default scenario, relative to the simulated duration:
+ *   0%   DCIN plugged, battery is partially charged, system powers on
+ *   30%  user holds power key (power off, board stays on DCIN)
+ *   50%  user clicks power key (power on)
+ *   60%  DCIN unplugged, system runs from battery
+ *   90%  DCIN plugged again
+ * */
+namespace Board {
+	constexpr uint64_t TICK					= 100 * Sim::MS;
+	constexpr uint64_t HOST_BOOT_TIME		= 2 * Sim::SEC;
+	constexpr uint64_t KEY_LONG_PRESS		= 6 * Sim::SEC;
+	constexpr uint64_t KEY_SHORT_PRESS		= 300 * Sim::MS;
+
+	constexpr double BAT_CAPACITY_MAH		= 2000;
+	constexpr double BAT_CHARGE_MA			= 500;
+	constexpr double SYSTEM_LOAD_MA			= 300;
+	constexpr double SLEEP_LOAD_MA			= 0.05;
+
+	constexpr int DCIN_MV					= 5000;
+	constexpr int LOGIC_HIGH_MV				= 1300;
+	constexpr int VDDA_MV					= 3300;
+
+	constexpr uint8_t PMIC_ADDR				= 0x34;
+	constexpr uint32_t HOST_RTC_TIME		= 1700000000;
+
+	// Registers polled by the Linux driver: one burst read of the telemetry snapshot
+	constexpr uint8_t POLL_REGS[] = {
+		25,	// SNAPSHOT
+	};
+	enum Action {
+		DCIN_ON,
+		DCIN_OFF,
+		KEY_CLICK,
+		KEY_HOLD,
+	};
+
+	struct Event {
+		int pct;
+		Action action;
+	};
+
+	constexpr Event SCENARIO[] = {
+		{30, KEY_HOLD},
+		{50, KEY_CLICK},
+		{60, DCIN_OFF},
+		{90, DCIN_ON},
+	};
+
+	constexpr uint8_t REG_IRQ_CHANGED	= 27;
+	constexpr uint8_t REG_RTC_TIME		= 12;
+	constexpr uint8_t REG_SNAPSHOT		= 25;
+
+	// Snapshot layout: version, size, seq, status, bat_voltage, ...
+	constexpr int SNAPSHOT_SIZE			= 32;
+	constexpr int SNAPSHOT_STATUS		= 4;
+	constexpr int SNAPSHOT_BAT_VOLTAGE	= 8;
+	constexpr int SNAPSHOT_RTC_TIME		= 24;
+
+	struct State {
+		uint64_t duration;
+		uint64_t poll_interval;
+
+		uint64_t next_tick;
+		uint64_t last_tick;
+
+		// Battery & power
+		double soc;
+		bool dcin;
+		bool key;
+		bool charging;
+		int bat_temp;
+
+		// Scenario
+		int step;
+		uint64_t key_release;
+
+		// Linux host
+		bool host_on;
+		uint64_t host_boot;
+		uint64_t next_poll;
+		bool rtc_synced;
+		uint8_t queue[16];
+		int queue_n;
+		int queue_pos;
+		bool busy;
+
+		uint64_t host_polls;
+		uint64_t host_irqs;
+		uint32_t last_status;
+		uint32_t last_vbat;
+		uint32_t last_rtc;
+	};
+
+	static State *state = nullptr;
+
+	static int vbat() {
+		return 3300 + static_cast<int>(900 * state->soc) + (state->charging ? 100 : 0);
+	}
+
+	static void hostRequestDone(void *, bool ok, const uint8_t *rx, int rx_n);
+	static void hostQueue(const uint8_t *regs, int n);
+
+	static void hostNext() {
+		if (state->busy || state->queue_pos >= state->queue_n)
+			return;
+
+		uint8_t reg = state->queue[state->queue_pos];
+		uint8_t tx[5] = {reg};
+		int tx_n = 1, rx_n = (reg == REG_SNAPSHOT ? SNAPSHOT_SIZE : 4);
+
+		if (reg == REG_RTC_TIME && !state->rtc_synced) {
+			memcpy(&tx[1], &HOST_RTC_TIME, sizeof(HOST_RTC_TIME));
+			tx_n = 5;
+			rx_n = 0;
+		}
+
+		state->busy = Sim::i2cTransfer(PMIC_ADDR, tx, tx_n, rx_n, hostRequestDone, nullptr);
+	}
+
+	static void hostRequestDone(void *, bool ok, const uint8_t *rx, int rx_n) {
+		uint8_t reg = state->queue[state->queue_pos++];
+		state->busy = false;
+
+		if (ok && reg == REG_SNAPSHOT && rx_n == SNAPSHOT_SIZE) {
+			memcpy(&state->last_status, &rx[SNAPSHOT_STATUS], sizeof(uint32_t));
+			uint16_t vbat;
+			memcpy(&vbat, &rx[SNAPSHOT_BAT_VOLTAGE], sizeof(vbat));
+			state->last_vbat = vbat;
+			memcpy(&state->last_rtc, &rx[SNAPSHOT_RTC_TIME], sizeof(uint32_t));
+		} else if (ok && rx_n == 4) {
+			uint32_t value;
+			memcpy(&value, rx, sizeof(value));
+			if (reg == 0)
+				state->last_status = value;
+			if (reg == 2)
+				state->last_vbat = value;
+			if (reg == REG_RTC_TIME)
+				state->last_rtc = value;
+
+			// Refresh only if the status really changed
+			if (reg == REG_IRQ_CHANGED && value)
+				hostQueue(POLL_REGS, COUNT_OF(POLL_REGS));
+		} else if (ok && reg == REG_RTC_TIME) {
+			state->rtc_synced = true;
+		}
+
+		hostNext();
+	}
+
+	static void hostQueue(const uint8_t *regs, int n) {
+		if (state->queue_pos >= state->queue_n) {
+			state->queue_n = 0;
+			state->queue_pos = 0;
+		}
+
+		for (int i = 0; i < n && state->queue_n < static_cast<int>(sizeof(state->queue)); i++)
+			state->queue[state->queue_n++] = regs[i];
+
+		hostNext();
+	}
+
+	static void hostProcess(uint64_t now) {
+		bool vcc = Sim::outputLevel(Pinout::VCC_EN.port, Pinout::VCC_EN.pin);
+
+		if (vcc != state->host_on) {
+			state->host_on = vcc;
+			state->host_boot = now + HOST_BOOT_TIME;
+			state->next_poll = state->host_boot;
+		}
+
+		if (!state->host_on || now < state->host_boot)
+			return;
+
+		if (!state->rtc_synced) {
+			const uint8_t regs[] = {REG_RTC_TIME};
+			hostQueue(regs, 1);
+		}
+
+		// I2C_IRQ is active low
+		bool irq = !Sim::outputLevel(Pinout::I2C_IRQ.port, Pinout::I2C_IRQ.pin);
+		if (irq && !state->busy) {
+			const uint8_t regs[] = {REG_IRQ_CHANGED};
+			state->host_irqs++;
+			hostQueue(regs, 1);
+		}
+
+		if (state->poll_interval && now >= state->next_poll) {
+			state->host_polls++;
+			state->next_poll = now + state->poll_interval;
+			hostQueue(POLL_REGS, COUNT_OF(POLL_REGS));
+		}
+	}
+
+	static void scenario(uint64_t now) {
+		if (state->step < static_cast<int>(COUNT_OF(SCENARIO))) {
+			const Event &event = SCENARIO[state->step];
+			if (now >= state->duration * event.pct / 100) {
+				switch (event.action) {
+					case DCIN_ON:	state->dcin = true;		break;
+					case DCIN_OFF:	state->dcin = false;	break;
+					case KEY_CLICK:
+					case KEY_HOLD:
+						state->key = true;
+						state->key_release = now + (event.action == KEY_HOLD ? KEY_LONG_PRESS : KEY_SHORT_PRESS);
+					break;
+				}
+				state->step++;
+			}
+		}
+
+		if (state->key && now >= state->key_release)
+			state->key = false;
+	}
+
+	static void battery(uint64_t now) {
+		double hours = static_cast<double>(now - state->last_tick) / (3600.0 * Sim::SEC);
+		bool charger_en = Sim::outputLevel(Pinout::CHARGER_EN.port, Pinout::CHARGER_EN.pin);
+		bool vcc = Sim::outputLevel(Pinout::VCC_EN.port, Pinout::VCC_EN.pin);
+
+		state->charging = charger_en && state->dcin && state->soc < 1.0;
+
+		double current = 0;
+		if (state->charging)
+			current += BAT_CHARGE_MA;
+		if (!state->dcin)
+			current -= vcc ? SYSTEM_LOAD_MA : SLEEP_LOAD_MA;
+
+		state->soc = std::max(0.0, std::min(1.0, state->soc + current * hours / BAT_CAPACITY_MAH));
+	}
+
+	Drive pinDrive(uint32_t port, uint16_t pin) {
+		if (port == Pinout::DCIN_ADC.port && pin == Pinout::DCIN_ADC.pin)
+			return analogMv(Pinout::ADC_CH_DCIN) >= LOGIC_HIGH_MV ? HIGH : LOW;
+
+		if (port == Pinout::VBAT_ADC.port && pin == Pinout::VBAT_ADC.pin)
+			return analogMv(Pinout::ADC_CH_VBAT) >= LOGIC_HIGH_MV ? HIGH : LOW;
+
+		if (port == Pinout::PWR_KEY.port && pin == Pinout::PWR_KEY.pin)
+			return state->key ? HIGH : LOW;
+
+		// Open-drain output of the charger
+		if (port == Pinout::CHARGER_STATUS.port && pin == Pinout::CHARGER_STATUS.pin)
+			return state->charging ? LOW : FLOAT;
+
+		return FLOAT;
+	}
+
+	int analogMv(int channel) {
+		switch (channel) {
+			case Pinout::ADC_CH_DCIN:
+				return state->dcin ? DCIN_MV / 2 : 0;
+
+			case Pinout::ADC_CH_VBAT:
+				return vbat() / 2;
+
+			case Pinout::ADC_CH_TEMP:
+			{
+				// Diode sensor is powered from BAT_TEMP_EN
+				if (!Sim::outputLevel(Pinout::BAT_TEMP_EN.port, Pinout::BAT_TEMP_EN.pin))
+					return 0;
+				return 592 + (state->bat_temp - 19000) * (536 - 592) / 26000;
+			}
+
+			case ADC_CHANNEL_TEMP:
+				return Sim::FACTORY_TS_CAL1 * VDDA_MV / 4095;
+
+			case ADC_CHANNEL_VREF:
+				return Sim::FACTORY_VREFINT_CAL * VDDA_MV / 4095;
+		}
+		return 0;
+	}
+
+	int vdda() {
+		return VDDA_MV;
+	}
+
+	uint64_t nextEvent() {
+		return state->next_tick;
+	}
+
+	void process(uint64_t now) {
+		battery(now);
+		scenario(now);
+		hostProcess(now);
+
+		state->last_tick = now;
+		state->next_tick = now + TICK;
+	}
+
+	void onBoot() {
+		// Transfer in flight was lost with the MCU
+		state->busy = false;
+		state->queue_n = 0;
+		state->queue_pos = 0;
+	}
+};
+
+static void boot() {
+	App app;
+	app.run();
+}
+
+static void usage(const char *name) {
+	fprintf(stderr, "usage: %s [-t hours] [-p poll_interval_s] [-s i2c_speed_hz] [-q]\n", name);
+	fprintf(stderr, "  -t  simulated time, hours (default: 24)\n");
+	fprintf(stderr, "  -p  Linux host polling interval, seconds, 0 - only IRQ (default: 10)\n");
+	fprintf(stderr, "  -s  I2C bus clock of the host, Hz (default: %u, Config::I2C_TIMING)\n", static_cast<unsigned>(Config::I2C_TIMING.speed));
+	fprintf(stderr, "  -q  hide firmware output\n");
+}
+
+static double percent(uint64_t part, uint64_t total) {
+	return total ? 100.0 * part / total : 0;
+}
+
+int main(int argc, char **argv) {
+	double hours = 24;
+	double poll = 10;
+	uint32_t i2c_speed = Config::I2C_TIMING.speed;
+	bool quiet = false;
+
+	int opt;
+	while ((opt = getopt(argc, argv, "t:p:s:qh")) != -1) {
+		switch (opt) {
+			case 't':	hours = atof(optarg);	break;
+			case 'p':	poll = atof(optarg);	break;
+			case 's':	i2c_speed = atoi(optarg);	break;
+			case 'q':	quiet = true;			break;
+			default:
+				usage(argv[0]);
+				return 1;
+		}
+	}
+
+	Board::state = static_cast<Board::State *>(Sim::shared(sizeof(Board::State)));
+	Board::State *state = Board::state;
+	state->duration = static_cast<uint64_t>(hours * 3600 * Sim::SEC);
+	state->poll_interval = static_cast<uint64_t>(poll * Sim::SEC);
+	state->soc = 0.3;
+	state->dcin = true;
+	state->bat_temp = 25000;
+	Sim::i2cSetSpeed(i2c_speed);
+
+	int saved_stdout = -1;
+	if (quiet) {
+		fflush(stdout);
+		saved_stdout = dup(STDOUT_FILENO);
+		int devnull = open("/dev/null", O_WRONLY);
+		dup2(devnull, STDOUT_FILENO);
+		close(devnull);
+	}
+
+	timespec start, end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	int status = Sim::run(state->duration, boot);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+
+	if (quiet) {
+		fflush(stdout);
+		dup2(saved_stdout, STDOUT_FILENO);
+		close(saved_stdout);
+	}
+
+	const Sim::Stats &stats = Sim::world->stats;
+	double wall = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+	double virt = static_cast<double>(Sim::world->now) / Sim::SEC;
+	uint64_t total_ns = stats.sleep_ns + stats.stop_ns + stats.standby_ns;
+
+	printf("\n");
+	printf("simulated:       %.1f s in %.3f s wall (x%.0f)\n", virt, wall, wall > 0 ? virt / wall : 0);
+	printf("exit:            %s\n", status == Sim::EXIT_END ? "end of simulation" : "halted");
+	printf("boots:           %llu (sw reset %llu, iwdg %llu, standby %llu)\n",
+		(unsigned long long) stats.boots, (unsigned long long) stats.resets_sw,
+		(unsigned long long) stats.resets_iwdg, (unsigned long long) stats.resets_standby);
+	printf("wakeups:         %llu (%.2f /s)\n", (unsigned long long) stats.wfi, virt > 0 ? stats.wfi / virt : 0);
+	printf("sleep modes:     sleep %.1f%% / stop %.1f%% / standby %.1f%%\n",
+		percent(stats.sleep_ns, total_ns), percent(stats.stop_ns, total_ns), percent(stats.standby_ns, total_ns));
+	printf("host cpu:        %.3f ms in firmware, %.0f ns per wakeup\n",
+		stats.active_host_ns / 1e6, stats.wfi ? static_cast<double>(stats.active_host_ns) / stats.wfi : 0);
+	printf("irq:            ");
+	for (int irq = 0; irq < Sim::IRQ_COUNT; irq++) {
+		if (!stats.irq[irq])
+			continue;
+		if (irq == Sim::IRQ_SYSTICK) {
+			printf(" systick=%llu", (unsigned long long) stats.irq[irq]);
+		} else {
+			printf(" %d=%llu", irq, (unsigned long long) stats.irq[irq]);
+		}
+	}
+	printf("\n");
+	printf("adc scans:       %llu\n", (unsigned long long) stats.adc_scans);
+	printf("i2c:             %llu transfers, %llu failed, %llu bytes, %.3f s on bus\n",
+		(unsigned long long) stats.i2c_transfers, (unsigned long long) stats.i2c_failures,
+		(unsigned long long) stats.i2c_bytes, stats.i2c_bus_ns / 1e9);
+	printf("i2c bus:         %u kHz, %.1f kB/s while busy, %.1f us per transfer\n", i2c_speed / 1000,
+		stats.i2c_bus_ns ? stats.i2c_bytes * 1e6 / stats.i2c_bus_ns : 0,
+		stats.i2c_transfers ? stats.i2c_bus_ns / 1e3 / stats.i2c_transfers : 0);
+	printf("linux host:      %llu polls, %llu irqs, status=%08X vbat=%u mV rtc=%u\n",
+		(unsigned long long) state->host_polls, (unsigned long long) state->host_irqs,
+		state->last_status, state->last_vbat, state->last_rtc);
+	printf("battery:         %.1f%% (%d mV), dcin %s\n", state->soc * 100, Board::vbat(), state->dcin ? "on" : "off");
+
+	return status;
+}
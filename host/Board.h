@@ -0,0 +1,29 @@
+#pragma once
+
+#include <cstdint>
+
+/*
+ * Outer world of the simulated MCU: battery, charger, DCIN, power key and the Linux host.
+ * */
+namespace Board {
+	enum Drive {
+		FLOAT,
+		LOW,
+		HIGH
+	};
+	
+	// Level driven on the pin from outside the MCU
+	Drive pinDrive(uint32_t port, uint16_t pin);
+	
+	// Voltage on ADC channel, mV
+	int analogMv(int channel);
+	
+	// Analog supply, mV
+	int vdda();
+	
+	uint64_t nextEvent();
+	void process(uint64_t now);
+	
+	// Called on every MCU boot
+	void onBoot();
+};
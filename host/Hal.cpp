@@ -0,0 +1,1363 @@
+#include "Sim.h"
+#include "Mcu.h"
+#include "Board.h"
+#include "RTC.h"
+
+#include <cstdio>
+#include <cstring>
+#include <algorithm>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/cm3/systick.h>
+#include <libopencm3/stm32/gpio.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/exti.h>
+#include <libopencm3/stm32/adc.h>
+#include <libopencm3/stm32/dma.h>
+#include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/syscfg.h>
+#include <libopencm3/stm32/rtc.h>
+#include <libopencm3/stm32/pwr.h>
+#include <libopencm3/stm32/iwdg.h>
+#include <libopencm3/stm32/usart.h>
+#include <libopencm3/stm32/timer.h>
+
+uint32_t rcc_ahb_frequency = 8000000;
+uint32_t rcc_apb1_frequency = 8000000;
+
+using Sim::mcu;
+using Sim::world;
+
+/*
+ * RCC
+ * */
+uint32_t Sim::rccCsrRead() {
+	return world->rcc_csr;
+}
+
+void Sim::rccCsrWrite(uint32_t value) {
+	if ((value & RCC_CSR_RMVF))
+		world->rcc_csr &= ~RCC_CSR_RESET_FLAGS;
+}
+
+void rcc_periph_clock_enable(enum rcc_periph_clken) { }
+void rcc_periph_clock_disable(enum rcc_periph_clken) { }
+void rcc_osc_on(enum rcc_osc) { }
+void rcc_osc_off(enum rcc_osc) { }
+void rcc_wait_for_osc_ready(enum rcc_osc) { }
+void rcc_set_rtc_clock_source(enum rcc_osc) { }
+void rcc_enable_rtc_clock(void) { }
+void rcc_set_ppre(uint32_t) { }
+void rcc_set_hpre(uint32_t) { }
+void rcc_set_i2c_clock_hsi(uint32_t) { }
+void rcc_set_i2c_clock_sysclk(uint32_t) { }
+
+static void i2cAbort();
+
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst) {
+	if (rst == RST_I2C1) {
+		i2cAbort();
+		memset(&mcu.i2c, 0, sizeof(mcu.i2c));
+	} else if (rst == RST_TIM3) {
+		mcu.tim3 = {};
+		mcu.tim3.next = Sim::NEVER;
+	}
+}
+
+/*
+ * SysTick
+ * */
+static uint64_t stkPeriod() {
+	uint32_t freq = (mcu.stk.csr & STK_CSR_CLKSOURCE_AHB) ? rcc_ahb_frequency : rcc_ahb_frequency / 8;
+	return Sim::SEC / freq;
+}
+
+static bool stkRunning() {
+	if (!(mcu.stk.csr & STK_CSR_ENABLE))
+		return false;
+	// HCLK is stopped in STOP mode
+	return Sim::sleepMode() == Sim::SLEEP;
+}
+
+static uint64_t stkNextEvent() {
+	if (!stkRunning())
+		return Sim::NEVER;
+	uint32_t counts = (mcu.stk.cvr == 0 ? mcu.stk.rvr + 1 : mcu.stk.cvr);
+	if (!mcu.stk.rvr && !mcu.stk.cvr)
+		return Sim::NEVER;
+	return mcu.stk.ref + counts * stkPeriod();
+}
+
+static void stkProcess(uint64_t to) {
+	if (!stkRunning()) {
+		mcu.stk.ref = to;
+		return;
+	}
+	
+	uint64_t counts = (to - mcu.stk.ref) / stkPeriod();
+	mcu.stk.ref += counts * stkPeriod();
+	
+	while (counts > 0) {
+		if (mcu.stk.cvr == 0) {
+			if (!mcu.stk.rvr)
+				break;
+			mcu.stk.cvr = mcu.stk.rvr;
+			counts--;
+		} else if (counts >= mcu.stk.cvr) {
+			counts -= mcu.stk.cvr;
+			mcu.stk.cvr = 0;
+			mcu.stk.csr |= STK_CSR_COUNTFLAG;
+			if ((mcu.stk.csr & STK_CSR_TICKINT))
+				Sim::pend(Sim::IRQ_SYSTICK);
+		} else {
+			mcu.stk.cvr -= counts;
+			counts = 0;
+		}
+	}
+}
+
+void systick_set_reload(uint32_t value) {
+	mcu.stk.rvr = value & 0xFFFFFF;
+}
+
+uint32_t systick_get_reload(void) {
+	return mcu.stk.rvr;
+}
+
+uint32_t systick_get_value(void) {
+	return mcu.stk.cvr;
+}
+
+void systick_set_clocksource(uint8_t clocksource) {
+	mcu.stk.csr = (mcu.stk.csr & ~STK_CSR_CLKSOURCE) | (clocksource & STK_CSR_CLKSOURCE);
+}
+
+void systick_interrupt_enable(void) {
+	mcu.stk.csr |= STK_CSR_TICKINT;
+}
+
+void systick_interrupt_disable(void) {
+	mcu.stk.csr &= ~STK_CSR_TICKINT;
+}
+
+void systick_counter_enable(void) {
+	// Read-modify-write of CSR clears COUNTFLAG
+	mcu.stk.csr = (mcu.stk.csr | STK_CSR_ENABLE) & ~STK_CSR_COUNTFLAG;
+	mcu.stk.ref = Sim::now();
+}
+
+void systick_counter_disable(void) {
+	mcu.stk.csr &= ~(STK_CSR_ENABLE | STK_CSR_COUNTFLAG);
+}
+
+uint8_t systick_get_countflag(void) {
+	bool flag = (mcu.stk.csr & STK_CSR_COUNTFLAG) != 0;
+	mcu.stk.csr &= ~STK_CSR_COUNTFLAG;
+	return flag;
+}
+
+/*
+ * GPIO & EXTI
+ * */
+static int portIndex(uint32_t port) {
+	int index = (port - GPIO_PORT_A_BASE) / 0x400;
+	if (index < 0 || index >= Sim::GPIO_PORTS)
+		Sim::halt("invalid GPIO port");
+	return index;
+}
+
+static bool pinLevel(int port, int pin) {
+	const Sim::GpioPort &gpio = mcu.gpio[port];
+	
+	if (gpio.mode[pin] == GPIO_MODE_OUTPUT)
+		return (gpio.odr & (1 << pin)) != 0;
+	
+	// Schmitt trigger is disabled in analog mode
+	if (gpio.mode[pin] == GPIO_MODE_ANALOG)
+		return false;
+	
+	switch (Board::pinDrive(GPIO_PORT_A_BASE + port * 0x400, 1 << pin)) {
+		case Board::HIGH:	return true;
+		case Board::LOW:	return false;
+		case Board::FLOAT:	return gpio.pupd[pin] == GPIO_PUPD_PULLUP;
+	}
+	return false;
+}
+
+static int extiIrq(int line) {
+	if (line <= 1)
+		return NVIC_EXTI0_1_IRQ;
+	if (line <= 3)
+		return NVIC_EXTI2_3_IRQ;
+	return NVIC_EXTI4_15_IRQ;
+}
+
+void Sim::halUpdateInputs() {
+	for (int line = 0; line < 16; line++) {
+		uint32_t bit = 1 << line;
+		bool level = pinLevel(mcu.exti.source[line], line);
+		bool prev = (mcu.exti.level & bit) != 0;
+		
+		if (level == prev)
+			continue;
+		
+		mcu.exti.level ^= bit;
+		
+		bool triggered = level ? (mcu.exti.rtsr & bit) : (mcu.exti.ftsr & bit);
+		if (triggered && (mcu.exti.imr & bit)) {
+			mcu.exti.pr |= bit;
+			pend(extiIrq(line));
+		}
+	}
+}
+
+bool Sim::outputLevel(uint32_t port, uint16_t pin) {
+	int index = portIndex(port);
+	for (int i = 0; i < 16; i++) {
+		if ((pin & (1 << i)))
+			return mcu.gpio[index].mode[i] == GPIO_MODE_OUTPUT && (mcu.gpio[index].odr & (1 << i));
+	}
+	return false;
+}
+
+void gpio_mode_setup(uint32_t gpioport, uint8_t mode, uint8_t pull_up_down, uint16_t gpios) {
+	Sim::GpioPort &gpio = mcu.gpio[portIndex(gpioport)];
+	for (int i = 0; i < 16; i++) {
+		if ((gpios & (1 << i))) {
+			gpio.mode[i] = mode;
+			gpio.pupd[i] = pull_up_down;
+		}
+	}
+	Sim::halUpdateInputs();
+}
+
+void gpio_set_output_options(uint32_t gpioport, uint8_t otype, uint8_t, uint16_t gpios) {
+	Sim::GpioPort &gpio = mcu.gpio[portIndex(gpioport)];
+	for (int i = 0; i < 16; i++) {
+		if ((gpios & (1 << i)))
+			gpio.otype[i] = otype;
+	}
+}
+
+void gpio_set_af(uint32_t gpioport, uint8_t alt_func_num, uint16_t gpios) {
+	Sim::GpioPort &gpio = mcu.gpio[portIndex(gpioport)];
+	for (int i = 0; i < 16; i++) {
+		if ((gpios & (1 << i)))
+			gpio.af[i] = alt_func_num;
+	}
+}
+
+void gpio_set(uint32_t gpioport, uint16_t gpios) {
+	mcu.gpio[portIndex(gpioport)].odr |= gpios;
+}
+
+void gpio_clear(uint32_t gpioport, uint16_t gpios) {
+	mcu.gpio[portIndex(gpioport)].odr &= ~gpios;
+}
+
+void gpio_toggle(uint32_t gpioport, uint16_t gpios) {
+	mcu.gpio[portIndex(gpioport)].odr ^= gpios;
+}
+
+uint16_t gpio_get(uint32_t gpioport, uint16_t gpios) {
+	int port = portIndex(gpioport);
+	uint16_t result = 0;
+	for (int i = 0; i < 16; i++) {
+		if ((gpios & (1 << i)) && pinLevel(port, i))
+			result |= 1 << i;
+	}
+	return result;
+}
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig) {
+	mcu.exti.rtsr &= ~extis;
+	mcu.exti.ftsr &= ~extis;
+	if (trig == EXTI_TRIGGER_RISING || trig == EXTI_TRIGGER_BOTH)
+		mcu.exti.rtsr |= extis;
+	if (trig == EXTI_TRIGGER_FALLING || trig == EXTI_TRIGGER_BOTH)
+		mcu.exti.ftsr |= extis;
+}
+
+void exti_enable_request(uint32_t extis) {
+	mcu.exti.imr |= extis;
+}
+
+void exti_disable_request(uint32_t extis) {
+	mcu.exti.imr &= ~extis;
+}
+
+void exti_reset_request(uint32_t extis) {
+	mcu.exti.pr &= ~extis;
+}
+
+void exti_select_source(uint32_t exti, uint32_t gpioport) {
+	for (int line = 0; line < 16; line++) {
+		if ((exti & (1 << line)))
+			mcu.exti.source[line] = gpioport ? portIndex(gpioport) : 0;
+	}
+	Sim::halUpdateInputs();
+}
+
+uint32_t exti_get_flag_status(uint32_t exti) {
+	return mcu.exti.pr & exti;
+}
+
+/*
+ * DMA
+ * */
+static int dmaIrq(int channel) {
+	if (channel == 1)
+		return NVIC_DMA1_CHANNEL1_IRQ;
+	if (channel <= 3)
+		return NVIC_DMA1_CHANNEL2_3_IRQ;
+	return NVIC_DMA1_CHANNEL4_5_IRQ;
+}
+
+static void dmaSetFlags(int channel, uint32_t flags) {
+	mcu.dma_isr |= (flags | DMA_GIF) << ((channel - 1) * 4);
+	
+	const Sim::DmaChannel &ch = mcu.dma[channel];
+	if (((flags & DMA_TCIF) && (ch.ccr & DMA_CCR_TCIE)) || ((flags & DMA_HTIF) && (ch.ccr & DMA_CCR_HTIE)))
+		Sim::pend(dmaIrq(channel));
+}
+
+static void dmaAdvance(int channel) {
+	Sim::DmaChannel &ch = mcu.dma[channel];
+	ch.cndtr--;
+	
+	uint32_t flags = 0;
+	if (ch.cndtr == ch.reload / 2)
+		flags |= DMA_HTIF;
+	
+	if (!ch.cndtr) {
+		flags |= DMA_TCIF;
+		if ((ch.ccr & DMA_CCR_CIRC))
+			ch.cndtr = ch.reload;
+	}
+	
+	if (flags)
+		dmaSetFlags(channel, flags);
+}
+
+// Peripheral -> memory request, returns false if the channel is not ready
+static bool dmaWrite(int channel, uint32_t value) {
+	Sim::DmaChannel &ch = mcu.dma[channel];
+	if (!(ch.ccr & DMA_CCR_EN) || !ch.cndtr)
+		return false;
+	
+	uint32_t index = (ch.ccr & DMA_CCR_MINC) ? ch.reload - ch.cndtr : 0;
+	switch (ch.ccr & DMA_CCR_MSIZE_MASK) {
+		case DMA_CCR_MSIZE_8BIT:	reinterpret_cast<uint8_t *>(ch.cmar)[index] = value;	break;
+		case DMA_CCR_MSIZE_16BIT:	reinterpret_cast<uint16_t *>(ch.cmar)[index] = value;	break;
+		default:					reinterpret_cast<uint32_t *>(ch.cmar)[index] = value;	break;
+	}
+	
+	dmaAdvance(channel);
+	return true;
+}
+
+// Memory -> peripheral request, returns false if the channel is not ready
+static bool dmaRead(int channel, uint32_t *value) {
+	Sim::DmaChannel &ch = mcu.dma[channel];
+	if (!(ch.ccr & DMA_CCR_EN) || !ch.cndtr)
+		return false;
+	
+	uint32_t index = (ch.ccr & DMA_CCR_MINC) ? ch.reload - ch.cndtr : 0;
+	switch (ch.ccr & DMA_CCR_MSIZE_MASK) {
+		case DMA_CCR_MSIZE_8BIT:	*value = reinterpret_cast<uint8_t *>(ch.cmar)[index];	break;
+		case DMA_CCR_MSIZE_16BIT:	*value = reinterpret_cast<uint16_t *>(ch.cmar)[index];	break;
+		default:					*value = reinterpret_cast<uint32_t *>(ch.cmar)[index];	break;
+	}
+	
+	dmaAdvance(channel);
+	return true;
+}
+
+void dma_channel_reset(uint32_t, uint8_t channel) {
+	mcu.dma[channel] = {};
+	mcu.dma_isr &= ~(DMA_IFLAGS << ((channel - 1) * 4));
+}
+
+void dma_clear_interrupt_flags(uint32_t, uint8_t channel, uint32_t interrupts) {
+	mcu.dma_isr &= ~(interrupts << ((channel - 1) * 4));
+}
+
+bool dma_get_interrupt_flag(uint32_t, uint8_t channel, uint32_t interrupts) {
+	return ((mcu.dma_isr >> ((channel - 1) * 4)) & interrupts) != 0;
+}
+
+void dma_enable_mem2mem_mode(uint32_t, uint8_t) {
+	// Ignored: the model always transfers on peripheral requests
+}
+
+void dma_set_memory_size(uint32_t, uint8_t channel, uint32_t mem_size) {
+	mcu.dma[channel].ccr = (mcu.dma[channel].ccr & ~DMA_CCR_MSIZE_MASK) | mem_size;
+}
+
+void dma_set_peripheral_size(uint32_t, uint8_t channel, uint32_t peripheral_size) {
+	mcu.dma[channel].ccr = (mcu.dma[channel].ccr & ~DMA_CCR_PSIZE_MASK) | peripheral_size;
+}
+
+void dma_enable_memory_increment_mode(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr |= DMA_CCR_MINC;
+}
+
+void dma_set_read_from_peripheral(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr &= ~DMA_CCR_DIR;
+}
+
+void dma_set_read_from_memory(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr |= DMA_CCR_DIR;
+}
+
+void dma_set_peripheral_address(uint32_t, uint8_t channel, uintptr_t address) {
+	mcu.dma[channel].cpar = address;
+}
+
+void dma_set_memory_address(uint32_t, uint8_t channel, uintptr_t address) {
+	mcu.dma[channel].cmar = address;
+}
+
+void dma_set_number_of_data(uint32_t, uint8_t channel, uint16_t number) {
+	mcu.dma[channel].cndtr = number;
+	mcu.dma[channel].reload = number;
+}
+
+uint16_t dma_get_number_of_data(uint32_t, uint8_t channel) {
+	return mcu.dma[channel].cndtr;
+}
+
+void dma_enable_circular_mode(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr |= DMA_CCR_CIRC;
+}
+
+void dma_enable_transfer_complete_interrupt(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr |= DMA_CCR_TCIE;
+}
+
+void dma_disable_transfer_complete_interrupt(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr &= ~DMA_CCR_TCIE;
+}
+
+void dma_enable_half_transfer_interrupt(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr |= DMA_CCR_HTIE;
+}
+
+void dma_disable_half_transfer_interrupt(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr &= ~DMA_CCR_HTIE;
+}
+
+void dma_enable_channel(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr |= DMA_CCR_EN;
+	// Number of data is reloaded from the programmed value
+	mcu.dma[channel].reload = std::max(mcu.dma[channel].reload, mcu.dma[channel].cndtr);
+}
+
+void dma_disable_channel(uint32_t, uint8_t channel) {
+	mcu.dma[channel].ccr &= ~DMA_CCR_EN;
+}
+
+/*
+ * ADC
+ * */
+static uint64_t adcScanTime() {
+	// Sampling time + 12.5 cycles of conversion at 14 MHz, in half-cycles
+	static const uint32_t smp_half_cycles[] = {3, 15, 27, 57, 83, 111, 143, 479};
+	uint64_t channels = __builtin_popcount(mcu.adc.chselr);
+	return channels * (smp_half_cycles[mcu.adc.smp & 7] + 25) * Sim::SEC / 28000000;
+}
+
+static void adcStop() {
+	mcu.adc.running = false;
+	mcu.adc.next = Sim::NEVER;
+}
+
+static void adcScan() {
+	world->stats.adc_scans++;
+	
+	for (int channel = 0; channel <= ADC_CHANNEL_VBAT; channel++) {
+		if (!(mcu.adc.chselr & (1 << channel)))
+			continue;
+		
+		int raw = Board::analogMv(channel) * 4095 / Board::vdda();
+		mcu.adc.dr = std::max(0, std::min(4095, raw));
+		
+		bool awd_channel = !mcu.adc.awd_sgl || mcu.adc.awd_ch == channel;
+		if (mcu.adc.awd && awd_channel && (mcu.adc.dr < mcu.adc.ltr || mcu.adc.dr > mcu.adc.htr)) {
+			mcu.adc.awd_flag = true;
+			if (mcu.adc.awd_ie)
+				Sim::pend(NVIC_ADC_COMP_IRQ);
+		}
+		
+		mcu.adc.eoc = true;
+		if (mcu.adc.eoc_ie)
+			Sim::pend(NVIC_ADC_COMP_IRQ);
+		
+		if (mcu.adc.dma) {
+			dmaWrite(1, mcu.adc.dr);
+			
+			// DMA one-shot mode: the sequence is stopped after the last DMA transfer
+			if (!mcu.adc.dma_circular && !mcu.dma[1].cndtr) {
+				adcStop();
+				return;
+			}
+		}
+	}
+}
+
+static void adcProcess(uint64_t to) {
+	while (mcu.adc.running && mcu.adc.next <= to) {
+		adcScan();
+		if (!mcu.adc.running)
+			break;
+		if (mcu.adc.continuous) {
+			mcu.adc.next += adcScanTime();
+		} else {
+			adcStop();
+		}
+	}
+}
+
+void adc_power_on(uint32_t) {
+	mcu.adc.powered = true;
+}
+
+void adc_power_off(uint32_t) {
+	mcu.adc.powered = false;
+	mcu.adc.started = false;
+	adcStop();
+}
+
+// Rising edge of the external trigger, conversion of the whole sequence
+static void adcTrigger() {
+	if (!mcu.adc.powered || !mcu.adc.started || mcu.adc.running)
+		return;
+	mcu.adc.running = true;
+	mcu.adc.next = Sim::now() + adcScanTime();
+}
+
+void adc_set_clk_source(uint32_t, uint32_t) { }
+void adc_calibrate(uint32_t) { }
+void adc_enable_autooff(uint32_t) { }
+void adc_disable_autooff(uint32_t) { }
+
+void adc_enable_external_trigger_regular(uint32_t, uint32_t trigger, uint32_t) {
+	// Only TIM3 is modelled
+	mcu.adc.ext_trigger = (trigger == ADC_CFGR1_EXTSEL_TIM3_TRGO);
+}
+
+void adc_disable_external_trigger_regular(uint32_t) {
+	mcu.adc.ext_trigger = false;
+}
+void adc_set_right_aligned(uint32_t) { }
+void adc_enable_temperature_sensor(void) { }
+void adc_enable_vrefint(void) { }
+void adc_set_resolution(uint32_t, uint16_t) { }
+void adc_enable_analog_watchdog_on_all_channels(uint32_t) {
+	mcu.adc.awd = true;
+	mcu.adc.awd_sgl = false;
+}
+
+void adc_enable_analog_watchdog_on_selected_channel(uint32_t, uint8_t chan) {
+	mcu.adc.awd = true;
+	mcu.adc.awd_sgl = true;
+	mcu.adc.awd_ch = chan;
+}
+
+void adc_disable_analog_watchdog(uint32_t) {
+	mcu.adc.awd = false;
+}
+
+void adc_set_watchdog_high_threshold(uint32_t, uint16_t threshold) {
+	mcu.adc.htr = threshold;
+}
+
+void adc_set_watchdog_low_threshold(uint32_t, uint16_t threshold) {
+	mcu.adc.ltr = threshold;
+}
+
+void adc_enable_watchdog_interrupt(uint32_t) {
+	mcu.adc.awd_ie = true;
+	if (mcu.adc.awd_flag)
+		Sim::pend(NVIC_ADC_COMP_IRQ);
+}
+
+void adc_disable_watchdog_interrupt(uint32_t) {
+	mcu.adc.awd_ie = false;
+}
+
+bool adc_get_watchdog_flag(uint32_t) {
+	return mcu.adc.awd_flag;
+}
+
+void adc_clear_watchdog_flag(uint32_t) {
+	mcu.adc.awd_flag = false;
+}
+
+void adc_enable_eoc_interrupt(uint32_t) {
+	mcu.adc.eoc_ie = true;
+	if (mcu.adc.eoc)
+		Sim::pend(NVIC_ADC_COMP_IRQ);
+}
+
+void adc_disable_eoc_interrupt(uint32_t) {
+	mcu.adc.eoc_ie = false;
+}
+
+bool adc_eoc(uint32_t) {
+	return mcu.adc.eoc;
+}
+
+uint32_t adc_read_regular(uint32_t) {
+	mcu.adc.eoc = false;
+	return mcu.adc.dr;
+}
+
+void adc_set_operation_mode(uint32_t, enum adc_opmode opmode) {
+	mcu.adc.continuous = (opmode == ADC_MODE_SCAN_INFINITE);
+}
+
+void adc_set_sample_time_on_all_channels(uint32_t, uint8_t time) {
+	mcu.adc.smp = time;
+}
+
+void adc_set_regular_sequence(uint32_t, uint8_t length, uint8_t channel[]) {
+	// ADC of STM32F0 converts selected channels in ascending order
+	mcu.adc.chselr = 0;
+	for (int i = 0; i < length; i++)
+		mcu.adc.chselr |= 1 << channel[i];
+}
+
+void adc_enable_dma(uint32_t) {
+	mcu.adc.dma = true;
+}
+
+void adc_disable_dma(uint32_t) {
+	mcu.adc.dma = false;
+}
+
+void adc_enable_dma_circular_mode(uint32_t) {
+	mcu.adc.dma_circular = true;
+}
+
+void adc_disable_dma_circular_mode(uint32_t) {
+	mcu.adc.dma_circular = false;
+}
+
+uint32_t Sim::adcCrRead() {
+	return (mcu.adc.powered ? ADC_CR_ADEN : 0) | (mcu.adc.started || mcu.adc.running ? ADC_CR_ADSTART : 0);
+}
+
+void Sim::adcCrWrite(uint32_t value) {
+	// Only ADSTP is modelled, the conversion in progress is discarded
+	if ((value & ADC_CR_ADSTP)) {
+		mcu.adc.started = false;
+		adcStop();
+	}
+}
+
+void adc_start_conversion_regular(uint32_t) {
+	if (!mcu.adc.powered || mcu.adc.running)
+		return;
+	if (mcu.adc.ext_trigger) {
+		mcu.adc.started = true;
+		return;
+	}
+	mcu.adc.running = true;
+	mcu.adc.next = Sim::now() + adcScanTime();
+}
+
+/*
+ * I2C slave, the host side is the bus master
+ * */
+enum I2CStep {
+	I2C_STEP_ADDR_WRITE,
+	I2C_STEP_RX,
+	I2C_STEP_ADDR_READ,
+	I2C_STEP_TX,
+	I2C_STEP_STOP,
+	I2C_STEP_DONE
+};
+
+constexpr uint64_t I2C_TIMEOUT = 25 * Sim::MS;
+
+static I2CStep i2cStepType(int step, int *byte) {
+	const Sim::I2CTransaction &xfer = mcu.i2c.xfer;
+	int w = xfer.tx_n > 0 ? 1 + xfer.tx_n : 0;
+	int r = xfer.rx_n > 0 ? 1 + xfer.rx_n : 0;
+	
+	if (step < w) {
+		*byte = step - 1;
+		return step == 0 ? I2C_STEP_ADDR_WRITE : I2C_STEP_RX;
+	}
+	
+	if (step < w + r) {
+		*byte = step - w - 1;
+		return step == w ? I2C_STEP_ADDR_READ : I2C_STEP_TX;
+	}
+	
+	return step == w + r ? I2C_STEP_STOP : I2C_STEP_DONE;
+}
+
+// SCL clock of the host, it is outside of the MCU and survives resets
+static uint32_t i2c_speed_hz = 100000;
+
+static uint64_t i2cByteTime() {
+	return 9 * Sim::SEC / i2c_speed_hz;
+}
+
+static void i2cFinish(bool ok) {
+	Sim::I2CTransaction &xfer = mcu.i2c.xfer;
+	
+	xfer.active = false;
+	world->stats.i2c_transfers++;
+	world->stats.i2c_bus_ns += Sim::now() - xfer.start;
+	if (!ok)
+		world->stats.i2c_failures++;
+	
+	mcu.i2c.isr &= ~(I2C_ISR_ADDR | I2C_ISR_RXNE | I2C_ISR_TXIS | I2C_ISR_STOPF | I2C_ISR_BUSY | I2C_ISR_DIR_READ);
+	
+	if (xfer.done)
+		xfer.done(xfer.ctx, ok, xfer.rx, ok ? xfer.rx_n : 0);
+}
+
+static void i2cAbort() {
+	if (mcu.i2c.xfer.active)
+		i2cFinish(false);
+}
+
+static void i2cRaise(uint32_t flag, uint32_t irq_enable) {
+	mcu.i2c.isr |= flag;
+	mcu.i2c.xfer.wait_isr = true;
+	mcu.i2c.xfer.timeout = Sim::now() + I2C_TIMEOUT;
+	if ((mcu.i2c.cr1 & irq_enable))
+		Sim::pend(NVIC_I2C1_IRQ);
+}
+
+// Byte is done, the master clocks the next one
+static void i2cNextStep() {
+	Sim::I2CTransaction &xfer = mcu.i2c.xfer;
+	xfer.wait_isr = false;
+	xfer.step++;
+	xfer.next = Sim::now() + i2cByteTime();
+}
+
+static bool i2cAddressMatch() {
+	if (!(mcu.i2c.cr1 & I2C_CR1_PE) || !(mcu.i2c.oar1 & I2C_OAR1_OA1EN_ENABLE))
+		return false;
+	if (((mcu.i2c.oar1 >> 1) & 0x7F) != mcu.i2c.xfer.addr)
+		return false;
+	// Kernel clock is stopped in STOP mode unless wakeup from STOP is enabled, which needs the digital filter off
+	if (Sim::sleepMode() == Sim::STOP && (!(mcu.i2c.cr1 & I2C_CR1_WUPEN) || (mcu.i2c.cr1 & (0xF << I2C_CR1_DNF_SHIFT))))
+		return false;
+	// Without the Fm+ drive the pins can't pull the bus down in time for the ACK
+	const uint32_t fmp_pins = SYSCFG_CFGR1_I2C_FMP_PA9 | SYSCFG_CFGR1_I2C_FMP_PA10;
+	if (i2c_speed_hz > 400000 && (mcu.syscfg.cfgr1 & fmp_pins) != fmp_pins)
+		return false;
+	return true;
+}
+
+static void i2cStep() {
+	Sim::I2CTransaction &xfer = mcu.i2c.xfer;
+	int byte = 0;
+	
+	switch (i2cStepType(xfer.step, &byte)) {
+		case I2C_STEP_ADDR_WRITE:
+		case I2C_STEP_ADDR_READ:
+			if (!i2cAddressMatch()) {
+				i2cFinish(false);
+				return;
+			}
+			
+			mcu.i2c.isr |= I2C_ISR_BUSY;
+			if (i2cStepType(xfer.step, &byte) == I2C_STEP_ADDR_READ) {
+				mcu.i2c.isr |= I2C_ISR_DIR_READ;
+			} else {
+				mcu.i2c.isr &= ~I2C_ISR_DIR_READ;
+			}
+			i2cRaise(I2C_ISR_ADDR, I2C_CR1_ADDRIE);
+		break;
+		
+		case I2C_STEP_RX:
+			mcu.i2c.rxdr = xfer.tx[byte];
+			world->stats.i2c_bytes++;
+			
+			// DMA request is served without stretching
+			if ((mcu.i2c.cr1 & I2C_CR1_RXDMAEN) && dmaWrite(3, mcu.i2c.rxdr)) {
+				i2cNextStep();
+				break;
+			}
+			
+			i2cRaise(I2C_ISR_RXNE, I2C_CR1_RXIE);
+		break;
+		
+		case I2C_STEP_TX:
+		{
+			world->stats.i2c_bytes++;
+			
+			uint32_t value;
+			if ((mcu.i2c.cr1 & I2C_CR1_TXDMAEN) && dmaRead(2, &value)) {
+				mcu.i2c.txdr = value;
+				xfer.rx[byte] = value;
+				i2cNextStep();
+				break;
+			}
+			
+			i2cRaise(I2C_ISR_TXIS, I2C_CR1_TXIE);
+		}
+		break;
+		
+		case I2C_STEP_STOP:
+			i2cRaise(I2C_ISR_STOPF, I2C_CR1_STOPIE);
+		break;
+		
+		case I2C_STEP_DONE:
+			i2cFinish(true);
+		break;
+	}
+}
+
+static void i2cAfterIsr() {
+	Sim::I2CTransaction &xfer = mcu.i2c.xfer;
+	
+	mcu.i2c.isr &= ~mcu.i2c.icr;
+	mcu.i2c.icr = 0;
+	
+	if (!xfer.active || !xfer.wait_isr)
+		return;
+	
+	int byte = 0;
+	bool handled = false;
+	
+	switch (i2cStepType(xfer.step, &byte)) {
+		case I2C_STEP_ADDR_WRITE:
+		case I2C_STEP_ADDR_READ:
+			handled = !(mcu.i2c.isr & I2C_ISR_ADDR);
+		break;
+		
+		case I2C_STEP_RX:
+			// RXDR was read by the ISR
+			mcu.i2c.isr &= ~I2C_ISR_RXNE;
+			handled = true;
+		break;
+		
+		case I2C_STEP_TX:
+			// TXDR was written by the ISR
+			xfer.rx[byte] = mcu.i2c.txdr;
+			mcu.i2c.isr &= ~I2C_ISR_TXIS;
+			handled = true;
+		break;
+		
+		case I2C_STEP_STOP:
+			handled = !(mcu.i2c.isr & I2C_ISR_STOPF);
+		break;
+		
+		case I2C_STEP_DONE:
+		break;
+	}
+	
+	if (handled)
+		i2cNextStep();
+}
+
+static uint64_t i2cNextEvent() {
+	const Sim::I2CTransaction &xfer = mcu.i2c.xfer;
+	if (!xfer.active)
+		return Sim::NEVER;
+	return xfer.wait_isr ? xfer.timeout : xfer.next;
+}
+
+static void i2cProcess(uint64_t to) {
+	while (mcu.i2c.xfer.active && i2cNextEvent() <= to) {
+		if (mcu.i2c.xfer.wait_isr) {
+			// Slave stretches SCL for too long, master gives up
+			i2cFinish(false);
+		} else {
+			i2cStep();
+		}
+	}
+}
+
+void Sim::i2cSetSpeed(uint32_t hz) {
+	i2c_speed_hz = hz;
+}
+
+bool Sim::i2cBusy() {
+	return mcu.i2c.xfer.active;
+}
+
+bool Sim::i2cTransfer(uint8_t addr, const uint8_t *tx, int tx_n, int rx_n, I2CDone done, void *ctx) {
+	I2CTransaction &xfer = mcu.i2c.xfer;
+	
+	if (xfer.active || tx_n > I2C_MAX_XFER || rx_n > I2C_MAX_XFER || (!tx_n && !rx_n))
+		return false;
+	
+	xfer = {};
+	xfer.active = true;
+	xfer.addr = addr;
+	xfer.tx_n = tx_n;
+	xfer.rx_n = rx_n;
+	xfer.start = now();
+	xfer.next = now() + i2cByteTime();
+	xfer.done = done;
+	xfer.ctx = ctx;
+	memcpy(xfer.tx, tx, tx_n);
+	
+	return true;
+}
+
+uint32_t Sim::i2cCr1Read() {
+	return mcu.i2c.cr1;
+}
+
+void Sim::i2cCr1Write(uint32_t value) {
+	uint32_t enabled = value & ~mcu.i2c.cr1;
+	mcu.i2c.cr1 = value;
+	
+	// Flags are level sensitive, enabling the interrupt of an already raised flag fires it
+	uint32_t raised = 0;
+	if ((mcu.i2c.isr & I2C_ISR_ADDR))
+		raised |= I2C_CR1_ADDRIE;
+	if ((mcu.i2c.isr & I2C_ISR_RXNE))
+		raised |= I2C_CR1_RXIE;
+	if ((mcu.i2c.isr & I2C_ISR_TXIS))
+		raised |= I2C_CR1_TXIE;
+	if ((mcu.i2c.isr & I2C_ISR_STOPF))
+		raised |= I2C_CR1_STOPIE;
+	
+	if ((enabled & raised))
+		pend(NVIC_I2C1_IRQ);
+}
+
+void i2c_peripheral_enable(uint32_t) {
+	mcu.i2c.cr1 |= I2C_CR1_PE;
+}
+
+void i2c_peripheral_disable(uint32_t) {
+	mcu.i2c.cr1 &= ~I2C_CR1_PE;
+}
+
+void i2c_enable_analog_filter(uint32_t) {
+	mcu.i2c.cr1 &= ~I2C_CR1_ANFOFF;
+}
+
+void i2c_disable_analog_filter(uint32_t) {
+	mcu.i2c.cr1 |= I2C_CR1_ANFOFF;
+}
+
+void i2c_set_digital_filter(uint32_t, uint8_t dnf_setting) {
+	mcu.i2c.cr1 = (mcu.i2c.cr1 & ~(0xF << I2C_CR1_DNF_SHIFT)) | ((dnf_setting & 0xF) << I2C_CR1_DNF_SHIFT);
+}
+
+static void i2cSetTiming(uint32_t shift, uint32_t mask, uint32_t value) {
+	mcu.i2c.timingr = (mcu.i2c.timingr & ~(mask << shift)) | ((value & mask) << shift);
+}
+
+void i2c_set_prescaler(uint32_t, uint8_t presc) {
+	i2cSetTiming(I2C_TIMINGR_PRESC_SHIFT, 0xF, presc);
+}
+
+void i2c_set_scl_low_period(uint32_t, uint8_t period) {
+	i2cSetTiming(I2C_TIMINGR_SCLL_SHIFT, 0xFF, period);
+}
+
+void i2c_set_scl_high_period(uint32_t, uint8_t period) {
+	i2cSetTiming(I2C_TIMINGR_SCLH_SHIFT, 0xFF, period);
+}
+
+void i2c_set_data_hold_time(uint32_t, uint8_t h_time) {
+	i2cSetTiming(I2C_TIMINGR_SDADEL_SHIFT, 0xF, h_time);
+}
+
+void i2c_set_data_setup_time(uint32_t, uint8_t s_time) {
+	i2cSetTiming(I2C_TIMINGR_SCLDEL_SHIFT, 0xF, s_time);
+}
+
+void i2c_set_7bit_addr_mode(uint32_t) { }
+
+void i2c_set_own_7bit_slave_address(uint32_t, uint8_t slave) {
+	mcu.i2c.oar1 = (mcu.i2c.oar1 & I2C_OAR1_OA1EN_ENABLE) | (slave << 1);
+}
+
+void i2c_enable_interrupt(uint32_t, uint32_t interrupt) {
+	mcu.i2c.cr1 |= interrupt;
+}
+
+void i2c_disable_interrupt(uint32_t, uint32_t interrupt) {
+	mcu.i2c.cr1 &= ~interrupt;
+}
+
+void i2c_enable_stretching(uint32_t) {
+	mcu.i2c.cr1 &= ~I2C_CR1_NOSTRETCH;
+}
+
+void i2c_enable_autoend(uint32_t) {
+	mcu.i2c.cr2 |= I2C_CR2_AUTOEND;
+}
+
+/*
+ * RTC, clocked from the virtual time
+ * */
+static uint32_t rtcUnixTime() {
+	return world->rtc_epoch + Sim::now() / Sim::SEC;
+}
+
+static uint32_t bcd(int value, int t_shift, int u_shift) {
+	return ((value / 10) << t_shift) | ((value % 10) << u_shift);
+}
+
+uint32_t Sim::rtcTrRead() {
+	RTC::tm now;
+	RTC::fromUnixTime(rtcUnixTime(), &now);
+	return (
+		bcd(now.hours, RTC_TR_HT_SHIFT, RTC_TR_HU_SHIFT) |
+		bcd(now.minutes, RTC_TR_MNT_SHIFT, RTC_TR_MNU_SHIFT) |
+		bcd(now.seconds, RTC_TR_ST_SHIFT, RTC_TR_SU_SHIFT)
+	);
+}
+
+uint32_t Sim::rtcDrRead() {
+	RTC::tm now;
+	RTC::fromUnixTime(rtcUnixTime(), &now);
+	return (
+		bcd(now.year - 2000, RTC_DR_YT_SHIFT, RTC_DR_YU_SHIFT) |
+		bcd(now.month, RTC_DR_MT_SHIFT, RTC_DR_MU_SHIFT) |
+		bcd(now.day, RTC_DR_DT_SHIFT, RTC_DR_DU_SHIFT)
+	);
+}
+
+static uint32_t rtcTicksPerSecond() {
+	return (world->rtc_prer & 0x7FFF) + 1;
+}
+
+uint32_t Sim::rtcSsrRead() {
+	uint64_t tps = rtcTicksPerSecond();
+	uint64_t ticks = Sim::now() % Sim::SEC * tps / Sim::SEC;
+	return tps - 1 - ticks;
+}
+
+// Next match of alarm A after the given time
+static void rtcScheduleAlarm(uint64_t after) {
+	world->rtc_alarm_at = Sim::NEVER;
+	if (!(world->rtc_cr & RTC_CR_ALRAE))
+		return;
+	
+	uint32_t alarm = world->rtc_alrmar;
+	uint64_t tps = rtcTicksPerSecond();
+	
+	// Position of the matching subsecond tick inside the second
+	uint64_t sub_ns = 0;
+	if (((world->rtc_alrmassr >> RTC_ALRMXSSR_MASKSS_SHIFT) & RTC_ALRMXSSR_MASKSS_MASK)) {
+		uint64_t tick = tps - 1 - (world->rtc_alrmassr & RTC_ALRMXSSR_SS_MASK);
+		sub_ns = (tick * Sim::SEC + tps - 1) / tps;
+	}
+	
+	auto field = [alarm](int t_shift, int t_mask, int u_shift, int u_mask) {
+		return RTC::decodeBCD(alarm, t_shift, t_mask, u_shift, u_mask);
+	};
+	
+	int64_t t = world->rtc_epoch + after / Sim::SEC;
+	for (int guard = 0; guard < 1000000; guard++) {
+		RTC::tm now;
+		RTC::fromUnixTime(t, &now);
+		
+		if (!(alarm & RTC_ALRMXR_MSK4) && now.day != field(RTC_ALRMXR_DT_SHIFT, RTC_ALRMXR_DT_MASK, RTC_ALRMXR_DU_SHIFT, RTC_ALRMXR_DU_MASK)) {
+			t += 86400 - t % 86400;
+		} else if (!(alarm & RTC_ALRMXR_MSK3) && now.hours != field(RTC_ALRMXR_HT_SHIFT, RTC_ALRMXR_HT_MASK, RTC_ALRMXR_HU_SHIFT, RTC_ALRMXR_HU_MASK)) {
+			t += 3600 - t % 3600;
+		} else if (!(alarm & RTC_ALRMXR_MSK2) && now.minutes != field(RTC_ALRMXR_MNT_SHIFT, RTC_ALRMXR_MNT_MASK, RTC_ALRMXR_MNU_SHIFT, RTC_ALRMXR_MNU_MASK)) {
+			t += 60 - t % 60;
+		} else if (!(alarm & RTC_ALRMXR_MSK1) && now.seconds != field(RTC_ALRMXR_ST_SHIFT, RTC_ALRMXR_ST_MASK, RTC_ALRMXR_SU_SHIFT, RTC_ALRMXR_SU_MASK)) {
+			t++;
+		} else {
+			uint64_t at = (t - world->rtc_epoch) * Sim::SEC + sub_ns;
+			if (at > after) {
+				world->rtc_alarm_at = at;
+				return;
+			}
+			t++;
+		}
+	}
+}
+
+static void rtcProcess(uint64_t to) {
+	while (world->rtc_alarm_at <= to) {
+		uint64_t at = world->rtc_alarm_at;
+		
+		world->rtc_isr |= RTC_ISR_ALRAF;
+		if ((world->rtc_cr & RTC_CR_ALRAIE))
+			world->rtc_alarm_wakeup = true;
+		
+		// Alarm is connected to EXTI17
+		if ((world->rtc_cr & RTC_CR_ALRAIE) && (mcu.exti.rtsr & EXTI17)) {
+			if ((mcu.exti.imr & EXTI17)) {
+				mcu.exti.pr |= EXTI17;
+				Sim::pend(NVIC_RTC_IRQ);
+			}
+		}
+		
+		rtcScheduleAlarm(at);
+	}
+}
+
+uint32_t Sim::rtcCrRead() {
+	return world->rtc_cr;
+}
+
+void Sim::rtcCrWrite(uint32_t value) {
+	world->rtc_cr = value;
+	rtcScheduleAlarm(now());
+}
+
+void Sim::rtcReadOnly(uint32_t) {
+	halt("write to read-only RTC register, use INIT mode");
+}
+
+void rtc_unlock(void) { }
+void rtc_lock(void) { }
+void rtc_wait_for_init_ready(void) { }
+void rtc_wait_for_synchro(void) { }
+void rtc_set_am_format(void) { }
+void rtc_set_pm_format(void) { }
+void rtc_enable_bypass_shadow_register(void) { }
+void rtc_disable_bypass_shadow_register(void) { }
+void rtc_calendar_set_weekday(uint8_t) { }
+
+bool rtc_init_flag_is_ready(void) {
+	return true;
+}
+
+void rtc_set_prescaler(uint32_t sync, uint32_t async) {
+	world->rtc_prer = (async << 16) | sync;
+}
+
+void rtc_set_init_flag(void) {
+	RTC::tm now;
+	RTC::fromUnixTime(rtcUnixTime(), &now);
+	
+	world->rtc_isr |= RTC_ISR_INIT | RTC_ISR_INITF;
+	world->rtc_set[0] = now.year;
+	world->rtc_set[1] = now.month;
+	world->rtc_set[2] = now.day;
+	world->rtc_set[3] = now.hours;
+	world->rtc_set[4] = now.minutes;
+	world->rtc_set[5] = now.seconds;
+}
+
+void rtc_clear_init_flag(void) {
+	const int *t = world->rtc_set;
+	world->rtc_isr &= ~(RTC_ISR_INIT | RTC_ISR_INITF);
+	world->rtc_epoch = static_cast<int64_t>(RTC::toUnixTime(t[0], t[1], t[2], t[3], t[4], t[5])) - Sim::now() / Sim::SEC;
+	rtcScheduleAlarm(Sim::now());
+}
+
+void rtc_calendar_set_year(uint8_t year) {
+	world->rtc_set[0] = 2000 + year;
+}
+
+void rtc_calendar_set_month(uint8_t rtc_dr_month) {
+	world->rtc_set[1] = rtc_dr_month;
+}
+
+void rtc_calendar_set_day(uint8_t rtc_dr_day) {
+	world->rtc_set[2] = rtc_dr_day;
+}
+
+void rtc_time_set_time(uint8_t hour, uint8_t minute, uint8_t second, bool) {
+	world->rtc_set[3] = hour;
+	world->rtc_set[4] = minute;
+	world->rtc_set[5] = second;
+}
+
+/*
+ * PWR, IWDG
+ * */
+void pwr_disable_backup_domain_write_protect(void) { }
+void pwr_enable_backup_domain_write_protect(void) { }
+void pwr_clear_standby_flag(void) { }
+void pwr_clear_wakeup_flag(void) { }
+void pwr_enable_power_voltage_detect(uint32_t) { }
+void pwr_disable_power_voltage_detect(void) { }
+
+void pwr_enable_wakeup_pin(void) {
+	mcu.pwr.ewup = true;
+}
+
+void pwr_disable_wakeup_pin(void) {
+	mcu.pwr.ewup = false;
+}
+
+void pwr_set_standby_mode(void) {
+	mcu.pwr.standby = true;
+}
+
+void pwr_set_stop_mode(void) {
+	mcu.pwr.standby = false;
+}
+
+void pwr_voltage_regulator_on_in_stop(void) {
+	mcu.pwr.low_power = false;
+}
+
+void pwr_voltage_regulator_low_power_in_stop(void) {
+	mcu.pwr.low_power = true;
+}
+
+bool Sim::halWakeupPin() {
+	// WKUP1 is PA0
+	return mcu.pwr.ewup && Board::pinDrive(GPIOA, GPIO0) == Board::HIGH;
+}
+
+void iwdg_set_period_ms(uint32_t period) {
+	mcu.iwdg.period = period * Sim::MS;
+}
+
+void iwdg_start(void) {
+	mcu.iwdg.running = true;
+	mcu.iwdg.deadline = Sim::now() + mcu.iwdg.period;
+}
+
+void iwdg_reset(void) {
+	mcu.iwdg.deadline = Sim::now() + mcu.iwdg.period;
+}
+
+bool iwdg_reload_busy(void) {
+	return false;
+}
+
+bool iwdg_prescaler_busy(void) {
+	return false;
+}
+
+/*
+ * TIM3: update events as the ADC trigger
+ * */
+static uint64_t tim3Period() {
+	return static_cast<uint64_t>(mcu.tim3.psc + 1) * (mcu.tim3.arr + 1) * Sim::SEC / rcc_apb1_frequency;
+}
+
+static uint64_t tim3NextEvent() {
+	// APB clock is stopped in STOP mode
+	return Sim::sleepMode() == Sim::SLEEP ? mcu.tim3.next : Sim::NEVER;
+}
+
+static void tim3Process(uint64_t to) {
+	if (!mcu.tim3.enabled || mcu.tim3.next > to)
+		return;
+	
+	if (Sim::sleepMode() != Sim::SLEEP) {
+		mcu.tim3.next += ((to - mcu.tim3.next) / tim3Period() + 1) * tim3Period();
+		return;
+	}
+	
+	while (mcu.tim3.next <= to) {
+		if (mcu.tim3.trgo_update)
+			adcTrigger();
+		mcu.tim3.next += tim3Period();
+	}
+}
+
+/*
+ * USART & TIM14: output is not modelled, printf() goes to stdout
+ * */
+void usart_set_baudrate(uint32_t, uint32_t) { }
+void usart_set_databits(uint32_t, uint32_t) { }
+void usart_set_stopbits(uint32_t, uint32_t) { }
+void usart_set_parity(uint32_t, uint32_t) { }
+void usart_set_mode(uint32_t, uint32_t) { }
+void usart_set_flow_control(uint32_t, uint32_t) { }
+void usart_enable(uint32_t) { }
+void usart_send_blocking(uint32_t, uint16_t) { }
+
+void timer_set_mode(uint32_t, uint32_t, uint32_t, uint32_t) { }
+void timer_continuous_mode(uint32_t) { }
+void timer_enable_break_main_output(uint32_t) { }
+void timer_set_prescaler(uint32_t timer, uint32_t value) {
+	if (timer == TIM3)
+		mcu.tim3.psc = value;
+}
+
+void timer_set_period(uint32_t timer, uint32_t period) {
+	if (timer == TIM3)
+		mcu.tim3.arr = period;
+}
+
+void timer_set_counter(uint32_t timer, uint32_t) {
+	if (timer == TIM3 && mcu.tim3.enabled)
+		mcu.tim3.next = Sim::now() + tim3Period();
+}
+
+void timer_set_master_mode(uint32_t timer, uint32_t mode) {
+	if (timer == TIM3)
+		mcu.tim3.trgo_update = (mode == TIM_CR2_MMS_UPDATE);
+}
+void timer_set_oc_mode(uint32_t, enum tim_oc_id, enum tim_oc_mode) { }
+void timer_enable_oc_preload(uint32_t, enum tim_oc_id) { }
+void timer_set_oc_polarity_high(uint32_t, enum tim_oc_id) { }
+void timer_set_oc_value(uint32_t, enum tim_oc_id, uint32_t) { }
+void timer_enable_oc_output(uint32_t, enum tim_oc_id) { }
+void timer_disable_oc_output(uint32_t, enum tim_oc_id) { }
+void timer_enable_preload(uint32_t) { }
+void timer_disable_preload(uint32_t) { }
+void timer_enable_counter(uint32_t timer) {
+	if (timer == TIM3 && !mcu.tim3.enabled) {
+		mcu.tim3.enabled = true;
+		mcu.tim3.next = Sim::now() + tim3Period();
+	}
+}
+
+void timer_disable_counter(uint32_t timer) {
+	if (timer == TIM3) {
+		mcu.tim3.enabled = false;
+		mcu.tim3.next = Sim::NEVER;
+	}
+}
+
+/*
+ * Model
+ * */
+void Sim::halReset() {
+	mcu = {};
+	mcu.adc.next = NEVER;
+	mcu.tim3.next = NEVER;
+}
+
+uint64_t Sim::halNextEvent() {
+	uint64_t next = NEVER;
+	
+	if (mcu.iwdg.running)
+		next = std::min(next, mcu.iwdg.deadline);
+	
+	// RTC is in the backup domain
+	next = std::min(next, world->rtc_alarm_at);
+	
+	if (sleepMode() == STANDBY)
+		return next;
+	
+	next = std::min(next, stkNextEvent());
+	next = std::min(next, mcu.adc.next);
+	next = std::min(next, tim3NextEvent());
+	next = std::min(next, i2cNextEvent());
+	return next;
+}
+
+void Sim::halProcess(uint64_t, uint64_t to) {
+	if (mcu.iwdg.running && to >= mcu.iwdg.deadline)
+		reset(RCC_CSR_IWDGRSTF);
+	
+	rtcProcess(to);
+	
+	if (sleepMode() == STANDBY)
+		return;
+	
+	stkProcess(to);
+	tim3Process(to);
+	adcProcess(to);
+	i2cProcess(to);
+}
+
+void Sim::halAfterIrq(int irq) {
+	if (irq == NVIC_I2C1_IRQ)
+		i2cAfterIsr();
+}
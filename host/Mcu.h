@@ -0,0 +1,135 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Sim.h"
+
+/*
+ * Peripheral state of the simulated MCU, lost on every reset.
+ * Register macros from host/include/libopencm3 point into this structure.
+ * */
+namespace Sim {
+	constexpr int GPIO_PORTS = 6;
+	constexpr int DMA_CHANNELS = 5;
+	constexpr int I2C_MAX_XFER = 64;
+	
+	struct GpioPort {
+		uint8_t mode[16];
+		uint8_t pupd[16];
+		uint8_t otype[16];
+		uint8_t af[16];
+		uint16_t odr;
+	};
+	
+	struct DmaChannel {
+		uint32_t ccr;
+		uint16_t cndtr;
+		uint16_t reload;
+		uintptr_t cpar;
+		uintptr_t cmar;
+	};
+	
+	struct I2CTransaction {
+		bool active;
+		uint8_t addr;
+		uint8_t tx[I2C_MAX_XFER];
+		uint8_t rx[I2C_MAX_XFER];
+		int tx_n;
+		int rx_n;
+		int step;
+		bool wait_isr;			// flag raised, bus is stretched until ISR handles it
+		uint64_t next;
+		uint64_t timeout;
+		uint64_t start;
+		I2CDone done;
+		void *ctx;
+	};
+	
+	struct Mcu {
+		uint32_t scb_scr;
+		
+		struct {
+			uint32_t csr;
+			uint32_t rvr;
+			uint32_t cvr;
+			uint64_t ref;
+		} stk;
+		
+		GpioPort gpio[GPIO_PORTS];
+		
+		struct {
+			uint32_t imr;
+			uint32_t rtsr;
+			uint32_t ftsr;
+			uint32_t pr;
+			uint32_t source[16];
+			uint32_t level;
+		} exti;
+		
+		struct {
+			bool powered;
+			bool dma;
+			bool dma_circular;
+			bool continuous;
+			bool running;
+			bool ext_trigger;
+			bool started;
+			bool awd;
+			bool awd_sgl;
+			bool awd_ie;
+			bool awd_flag;
+			uint8_t awd_ch;
+			bool eoc_ie;
+			bool eoc;
+			uint16_t ltr;
+			uint16_t htr;
+			uint32_t cfgr1;
+			uint32_t chselr;
+			uint8_t smp;
+			uint32_t dr;
+			uint64_t next;
+		} adc;
+		
+		// TIM3 is modelled only as the ADC trigger source
+		struct {
+			bool enabled;
+			bool trgo_update;
+			uint32_t psc;
+			uint32_t arr;
+			uint64_t next;
+		} tim3;
+		
+		DmaChannel dma[DMA_CHANNELS + 1];
+		uint32_t dma_isr;
+		
+		struct {
+			uint32_t cr1;
+			uint32_t cr2;
+			uint32_t oar1;
+			uint32_t isr;
+			uint32_t icr;
+			uint32_t rxdr;
+			uint32_t txdr;
+			uint32_t timingr;
+			I2CTransaction xfer;
+		} i2c;
+		
+		struct {
+			bool standby;
+			bool low_power;
+			bool ewup;
+		} pwr;
+		
+		struct {
+			uint32_t cfgr1;
+		} syscfg;
+		
+		struct {
+			bool running;
+			uint64_t period;
+			uint64_t deadline;
+		} iwdg;
+	};
+	
+	extern Mcu mcu;
+};
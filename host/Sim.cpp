@@ -0,0 +1,274 @@
+#include "Sim.h"
+#include "Mcu.h"
+#include "Board.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <ctime>
+#include <algorithm>
+
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+
+#include <libopencm3/cm3/nvic.h>
+#include <libopencm3/cm3/scb.h>
+#include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/rtc.h>
+
+namespace Sim {
+	World *world = nullptr;
+	Mcu mcu = {};
+	
+	static bool m_primask = false;
+	static bool m_in_handler = false;
+	static uint32_t m_nvic_enabled = 0;
+	static uint64_t m_pending = 0;
+	static uint64_t m_active_since = 0;
+	
+	static uint64_t hostNs() {
+		timespec ts;
+		clock_gettime(CLOCK_MONOTONIC, &ts);
+		return static_cast<uint64_t>(ts.tv_sec) * SEC + ts.tv_nsec;
+	}
+};
+
+/*
+ * Default handlers, like the weak vector table of libopencm3.
+ * */
+#define SIM_DEFAULT_HANDLER(name) \
+	extern "C" __attribute__((weak)) void name(void) { Sim::halt("unhandled irq: " #name); }
+
+SIM_DEFAULT_HANDLER(sys_tick_handler)
+SIM_DEFAULT_HANDLER(rtc_isr)
+SIM_DEFAULT_HANDLER(exti0_1_isr)
+SIM_DEFAULT_HANDLER(exti2_3_isr)
+SIM_DEFAULT_HANDLER(exti4_15_isr)
+SIM_DEFAULT_HANDLER(dma1_channel1_isr)
+SIM_DEFAULT_HANDLER(dma1_channel2_3_isr)
+SIM_DEFAULT_HANDLER(dma1_channel4_5_isr)
+SIM_DEFAULT_HANDLER(adc_comp_isr)
+SIM_DEFAULT_HANDLER(tim14_isr)
+SIM_DEFAULT_HANDLER(i2c1_isr)
+SIM_DEFAULT_HANDLER(usart1_isr)
+
+static void (*getHandler(int irq))(void) {
+	switch (irq) {
+		case Sim::IRQ_SYSTICK:				return sys_tick_handler;
+		case NVIC_RTC_IRQ:					return rtc_isr;
+		case NVIC_EXTI0_1_IRQ:				return exti0_1_isr;
+		case NVIC_EXTI2_3_IRQ:				return exti2_3_isr;
+		case NVIC_EXTI4_15_IRQ:				return exti4_15_isr;
+		case NVIC_DMA1_CHANNEL1_IRQ:		return dma1_channel1_isr;
+		case NVIC_DMA1_CHANNEL2_3_IRQ:		return dma1_channel2_3_isr;
+		case NVIC_DMA1_CHANNEL4_5_IRQ:		return dma1_channel4_5_isr;
+		case NVIC_ADC_COMP_IRQ:				return adc_comp_isr;
+		case NVIC_TIM14_IRQ:				return tim14_isr;
+		case NVIC_I2C1_IRQ:					return i2c1_isr;
+		case NVIC_USART1_IRQ:				return usart1_isr;
+	}
+	return nullptr;
+}
+
+void nvic_enable_irq(uint8_t irqn) {
+	Sim::m_nvic_enabled |= 1 << irqn;
+}
+
+void nvic_disable_irq(uint8_t irqn) {
+	Sim::m_nvic_enabled &= ~(1 << irqn);
+}
+
+void nvic_set_priority(uint8_t, uint8_t) {
+	// All IRQs have the same priority in the model
+}
+
+void scb_reset_system(void) {
+	Sim::reset(RCC_CSR_SFTRSTF);
+}
+
+uint64_t Sim::now() {
+	return world->now;
+}
+
+Sim::SleepMode Sim::sleepMode() {
+	if (!(mcu.scb_scr & SCB_SCR_SLEEPDEEP))
+		return SLEEP;
+	return mcu.pwr.standby ? STANDBY : STOP;
+}
+
+bool Sim::isIrqEnabled(int irq) {
+	if (irq == IRQ_SYSTICK)
+		return true;
+	return (m_nvic_enabled & (1 << irq)) != 0;
+}
+
+void Sim::pend(int irq) {
+	m_pending |= 1ULL << irq;
+}
+
+static bool hasPendingIrq() {
+	for (int irq = 0; irq < Sim::IRQ_COUNT; irq++) {
+		if ((Sim::m_pending & (1ULL << irq)) && Sim::isIrqEnabled(irq))
+			return true;
+	}
+	return false;
+}
+
+static void dispatch() {
+	if (Sim::m_primask || Sim::m_in_handler)
+		return;
+	
+	bool found;
+	do {
+		found = false;
+		
+		// SysTick has the highest priority, then NVIC lines by number
+		for (int n = 0; n < Sim::IRQ_COUNT && !Sim::m_primask; n++) {
+			int irq = (n == 0 ? Sim::IRQ_SYSTICK : n - 1);
+			if (!(Sim::m_pending & (1ULL << irq)) || !Sim::isIrqEnabled(irq))
+				continue;
+			
+			Sim::m_pending &= ~(1ULL << irq);
+			Sim::world->stats.irq[irq]++;
+			
+			Sim::m_in_handler = true;
+			getHandler(irq)();
+			Sim::halAfterIrq(irq);
+			Sim::m_in_handler = false;
+			
+			found = true;
+			break;
+		}
+	} while (found);
+}
+
+void Sim::disableIrq() {
+	m_primask = true;
+}
+
+void Sim::enableIrq() {
+	m_primask = false;
+	dispatch();
+}
+
+static void advance(Sim::SleepMode mode) {
+	uint64_t from = Sim::world->now;
+	uint64_t to = std::min({Sim::world->end, Board::nextEvent(), Sim::halNextEvent()});
+	
+	if (to <= from)
+		to = from;
+	
+	switch (mode) {
+		case Sim::RUN:
+		case Sim::SLEEP:	Sim::world->stats.sleep_ns += to - from;	break;
+		case Sim::STOP:		Sim::world->stats.stop_ns += to - from;		break;
+		case Sim::STANDBY:	Sim::world->stats.standby_ns += to - from;	break;
+	}
+	
+	Sim::world->now = to;
+	Sim::halProcess(from, to);
+	
+	if (to >= Board::nextEvent()) {
+		Board::process(to);
+		Sim::halUpdateInputs();
+	}
+	
+	if (to >= Sim::world->end) {
+		fflush(stdout);
+		_exit(Sim::EXIT_END);
+	}
+}
+
+static void standby() {
+	// Only the wakeup pin and the backup domain are alive, exit from STANDBY is a reset
+	Sim::world->rtc_alarm_wakeup = false;
+	while (!Sim::halWakeupPin() && !Sim::world->rtc_alarm_wakeup)
+		advance(Sim::STANDBY);
+	
+	Sim::world->stats.resets_standby++;
+	Sim::reset(0);
+}
+
+void Sim::wfi() {
+	uint64_t host_now = hostNs();
+	world->stats.active_host_ns += host_now - m_active_since;
+	world->stats.wfi++;
+	
+	SleepMode mode = sleepMode();
+	if (mode == STANDBY)
+		standby();
+	
+	while (!hasPendingIrq())
+		advance(mode);
+	
+	m_active_since = hostNs();
+	dispatch();
+}
+
+void Sim::reset(uint32_t rcc_csr_flags) {
+	if ((rcc_csr_flags & RCC_CSR_SFTRSTF))
+		world->stats.resets_sw++;
+	if ((rcc_csr_flags & RCC_CSR_IWDGRSTF))
+		world->stats.resets_iwdg++;
+	
+	world->rcc_csr |= rcc_csr_flags;
+	fflush(stdout);
+	_exit(EXIT_RESET);
+}
+
+void Sim::halt(const char *reason) {
+	fprintf(stderr, "[sim] MCU halted at %.3f s: %s\n", static_cast<double>(world->now) / SEC, reason);
+	fflush(stdout);
+	_exit(EXIT_HALT);
+}
+
+void *Sim::shared(size_t size) {
+	void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+	if (ptr == MAP_FAILED) {
+		perror("mmap");
+		exit(1);
+	}
+	return ptr;
+}
+
+int Sim::run(uint64_t duration, void (*boot)()) {
+	if (!world) {
+		world = static_cast<World *>(shared(sizeof(World)));
+		world->rtc_isr = RTC_ISR_ALRAWF | RTC_ISR_WUTWF | RTC_ISR_INITS | RTC_ISR_RSF;
+		world->rtc_alarm_at = NEVER;
+	}
+	
+	world->end = world->now + duration;
+	
+	while (true) {
+		fflush(stdout);
+		
+		pid_t pid = fork();
+		if (pid < 0) {
+			perror("fork");
+			return EXIT_HALT;
+		}
+		
+		if (pid == 0) {
+			// Power-on state of the MCU
+			world->stats.boots++;
+			halReset();
+			Board::onBoot();
+			halUpdateInputs();
+			m_active_since = hostNs();
+			boot();
+			halt("firmware returned from main()");
+		}
+		
+		int status = 0;
+		waitpid(pid, &status, 0);
+		
+		if (!WIFEXITED(status)) {
+			fprintf(stderr, "[sim] firmware crashed (signal %d)\n", WIFSIGNALED(status) ? WTERMSIG(status) : 0);
+			return EXIT_HALT;
+		}
+		
+		if (WEXITSTATUS(status) != EXIT_RESET)
+			return WEXITSTATUS(status);
+	}
+}
@@ -0,0 +1,164 @@
+#pragma once
+
+#include <cstdint>
+#include <cstddef>
+
+/*
+ * Host-side model of the STM32F030 running the PMIC firmware.
+ *
+ * The firmware sources from src/ are compiled unchanged against the libopencm3 subset in
+ * host/include, which is backed by the peripheral model in Hal.cpp. Time is virtual: it
+ * only moves forward while the firmware sleeps in WFI, so hours of board life are
+ * simulated in seconds. The board around the MCU (battery, charger, DCIN, power key and
+ * the Linux host on the I2C bus) lives in Board.cpp.
+ *
+ * Every firmware boot runs in a forked child process, so an MCU reset wipes RAM exactly
+ * like on hardware, while the backup domain, the outer world and the statistics are kept
+ * in shared memory and survive resets.
+ * */
+namespace Sim {
+	constexpr uint64_t US = 1000;
+	constexpr uint64_t MS = 1000 * US;
+	constexpr uint64_t SEC = 1000 * MS;
+	
+	constexpr uint64_t NEVER = UINT64_MAX;
+	
+	// Factory calibration values (typical values from the datasheet)
+	constexpr uint16_t FACTORY_VREFINT_CAL	= 1526;		// 1.23 V @ VDDA=3.3 V
+	constexpr uint16_t FACTORY_TS_CAL1		= 1775;		// 1.43 V @ 30 °C
+	constexpr uint16_t FACTORY_TS_CAL2		= 1347;		// 1.085 V @ 110 °C
+	
+	enum ExitCode : int {
+		EXIT_END	= 0,
+		EXIT_RESET	= 3,
+		EXIT_HALT	= 4,
+	};
+	
+	enum SleepMode {
+		RUN,
+		SLEEP,
+		STOP,
+		STANDBY
+	};
+	
+	// Pseudo IRQ numbers for core exceptions, placed after the 32 NVIC lines
+	constexpr int IRQ_SYSTICK	= 32;
+	constexpr int IRQ_COUNT		= 33;
+	
+	struct Stats {
+		uint64_t boots;
+		uint64_t resets_sw;
+		uint64_t resets_iwdg;
+		uint64_t resets_standby;
+		
+		uint64_t wfi;
+		uint64_t sleep_ns;
+		uint64_t stop_ns;
+		uint64_t standby_ns;
+		uint64_t irq[IRQ_COUNT];
+		
+		// Host CPU time spent in firmware code (scheduler, tasks, ISRs)
+		uint64_t active_host_ns;
+		
+		uint64_t adc_scans;
+		
+		uint64_t i2c_transfers;
+		uint64_t i2c_failures;
+		uint64_t i2c_bytes;
+		uint64_t i2c_bus_ns;
+	};
+	
+	// State which survives MCU resets
+	struct World {
+		uint64_t now;
+		uint64_t end;
+		
+		// RCC_CSR reset flags
+		uint32_t rcc_csr;
+		
+		// RTC (backup domain)
+		int64_t rtc_epoch;			// unix time at now == 0
+		uint32_t rtc_cr;
+		uint32_t rtc_isr;
+		uint32_t rtc_alrmar;
+		uint32_t rtc_alrmassr;
+		uint64_t rtc_alarm_at;		// next alarm A match
+		bool rtc_alarm_wakeup;		// alarm A event with ALRAIE, exits STANDBY
+		uint32_t rtc_prer;
+		uint32_t rtc_bkp[42];
+		int rtc_set[6];				// calendar fields written in INIT mode
+		
+		Stats stats;
+	};
+	
+	/*
+	 * Register with side effects on read or write.
+	 * */
+	class Register {
+		protected:
+			uint32_t (*m_read)();
+			void (*m_write)(uint32_t);
+		public:
+			constexpr Register(uint32_t (*read)(), void (*write)(uint32_t)) : m_read(read), m_write(write) { }
+			
+			inline operator uint32_t() const {
+				return m_read();
+			}
+			
+			inline const Register &operator=(uint32_t value) const {
+				m_write(value);
+				return *this;
+			}
+			
+			inline const Register &operator|=(uint32_t value) const {
+				m_write(m_read() | value);
+				return *this;
+			}
+			
+			inline const Register &operator&=(uint32_t value) const {
+				m_write(m_read() & value);
+				return *this;
+			}
+	};
+	
+	extern World *world;
+	
+	// Core
+	uint64_t now();
+	SleepMode sleepMode();
+	void disableIrq();
+	void enableIrq();
+	void wfi();
+	void pend(int irq);
+	bool isIrqEnabled(int irq);
+	[[noreturn]] void reset(uint32_t rcc_csr_flags);
+	[[noreturn]] void halt(const char *reason);
+	void *shared(size_t size);
+	int run(uint64_t duration, void (*boot)());
+	
+	// Peripherals (Hal.cpp)
+	void halReset();
+	uint64_t halNextEvent();
+	void halProcess(uint64_t from, uint64_t to);
+	void halAfterIrq(int irq);
+	void halUpdateInputs();
+	bool halWakeupPin();
+	
+	bool outputLevel(uint32_t port, uint16_t pin);
+	
+	// Host side of the I2C bus
+	typedef void (*I2CDone)(void *ctx, bool ok, const uint8_t *rx, int rx_n);
+	bool i2cTransfer(uint8_t addr, const uint8_t *tx, int tx_n, int rx_n, I2CDone done, void *ctx);
+	bool i2cBusy();
+	void i2cSetSpeed(uint32_t hz);
+};
+
+#define DISABLE_INTERRUPTS()			Sim::disableIrq()
+#define ENABLE_INTERRUPTS()				Sim::enableIrq()
+#define WAIT_FOR_INTERRUPT()			Sim::wfi()
+#define DATA_SYNC_BARRIER()				do { } while (false)
+#define INSTRUCTION_SYNC_BARRIER()		do { } while (false)
+
+#define VREFINT_CAL		(Sim::FACTORY_VREFINT_CAL)
+#define TS_CAL1			(Sim::FACTORY_TS_CAL1)
+#define TS_CAL2			(Sim::FACTORY_TS_CAL2)
@@ -0,0 +1,40 @@
+# Host (x86/Linux) build of the firmware with the simulated HAL from host/
+#   make host
+#   ./bin/host/stm32f0-pmic-sim -t 24 -q
+
+PROJECT = stm32f0-pmic-sim
+BUILD_DIR = bin/host
+
+HOST_CXX ?= g++
+
+CXXFILES += $(filter-out src/main.cpp,$(wildcard src/*.cpp))
+CXXFILES += $(wildcard host/*.cpp)
+
+INCLUDES += -Ihost -Ihost/include -Isrc -Ilib/delegate/include
+
+HOST_CXXFLAGS += -O2 -std=c++17 -ggdb3 -fno-exceptions -fno-rtti -DHOST_BUILD
+HOST_CXXFLAGS += -MD -Wall -Wundef -Wextra -Wshadow -Wredundant-decls
+
+OBJS = $(CXXFILES:%.cpp=$(BUILD_DIR)/%.o)
+
+V ?= 0
+ifeq ($(V),0)
+Q := @
+endif
+
+all: $(BUILD_DIR)/$(PROJECT)
+
+$(BUILD_DIR)/%.o: %.cpp
+	@printf "  HOSTCXX\t$<\n"
+	@mkdir -p $(dir $@)
+	$(Q)$(HOST_CXX) $(HOST_CXXFLAGS) $(INCLUDES) $(HOST_CPPFLAGS) -o $@ -c $<
+
+$(BUILD_DIR)/$(PROJECT): $(OBJS)
+	@printf "  HOSTLD\t$@\n"
+	$(Q)$(HOST_CXX) $(OBJS) $(HOST_LDFLAGS) -o $@
+
+clean:
+	rm -rf $(BUILD_DIR)
+
+.PHONY: all clean
+-include $(OBJS:.o=.d)
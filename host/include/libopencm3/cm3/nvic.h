@@ -0,0 +1,39 @@
+#pragma once
+
+#include <cstdint>
+
+#define NVIC_WWDG_IRQ					0
+#define NVIC_PVD_IRQ					1
+#define NVIC_RTC_IRQ					2
+#define NVIC_FLASH_IRQ					3
+#define NVIC_RCC_IRQ					4
+#define NVIC_EXTI0_1_IRQ				5
+#define NVIC_EXTI2_3_IRQ				6
+#define NVIC_EXTI4_15_IRQ				7
+#define NVIC_TSC_IRQ					8
+#define NVIC_DMA1_CHANNEL1_IRQ			9
+#define NVIC_DMA1_CHANNEL2_3_IRQ		10
+#define NVIC_DMA1_CHANNEL4_5_IRQ		11
+#define NVIC_ADC_COMP_IRQ				12
+#define NVIC_TIM14_IRQ					19
+#define NVIC_I2C1_IRQ					23
+#define NVIC_USART1_IRQ					27
+
+void nvic_enable_irq(uint8_t irqn);
+void nvic_disable_irq(uint8_t irqn);
+void nvic_set_priority(uint8_t irqn, uint8_t priority);
+
+extern "C" {
+	void sys_tick_handler(void);
+	void rtc_isr(void);
+	void exti0_1_isr(void);
+	void exti2_3_isr(void);
+	void exti4_15_isr(void);
+	void dma1_channel1_isr(void);
+	void dma1_channel2_3_isr(void);
+	void dma1_channel4_5_isr(void);
+	void adc_comp_isr(void);
+	void tim14_isr(void);
+	void i2c1_isr(void);
+	void usart1_isr(void);
+}
@@ -0,0 +1,10 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define SCB_SCR						(Sim::mcu.scb_scr)
+#define SCB_SCR_SLEEPONEXIT			(1 << 1)
+#define SCB_SCR_SLEEPDEEP			(1 << 2)
+#define SCB_SCR_SEVEONPEND			(1 << 4)
+
+void scb_reset_system(void);
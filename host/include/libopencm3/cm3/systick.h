@@ -0,0 +1,24 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define STK_CSR						(Sim::mcu.stk.csr)
+#define STK_RVR						(Sim::mcu.stk.rvr)
+#define STK_CVR						(Sim::mcu.stk.cvr)
+
+#define STK_CSR_ENABLE				(1 << 0)
+#define STK_CSR_TICKINT				(1 << 1)
+#define STK_CSR_CLKSOURCE			(1 << 2)
+#define STK_CSR_CLKSOURCE_EXT		(0 << 2)
+#define STK_CSR_CLKSOURCE_AHB		(1 << 2)
+#define STK_CSR_COUNTFLAG			(1 << 16)
+
+void systick_set_reload(uint32_t value);
+uint32_t systick_get_reload(void);
+uint32_t systick_get_value(void);
+void systick_set_clocksource(uint8_t clocksource);
+void systick_interrupt_enable(void);
+void systick_interrupt_disable(void);
+void systick_counter_enable(void);
+void systick_counter_disable(void);
+uint8_t systick_get_countflag(void);
@@ -0,0 +1,85 @@
+#pragma once
+
+#include <Mcu.h>
+#include <libopencm3/stm32/gpio.h>
+
+#define ADC1						0x40012400U
+
+namespace Sim {
+	uint32_t adcCrRead();
+	void adcCrWrite(uint32_t value);
+};
+
+#define ADC_CR(base)					(Sim::Register(Sim::adcCrRead, Sim::adcCrWrite))
+#define ADC_DR(base)					(Sim::mcu.adc.dr)
+#define ADC_CFGR1(base)					(Sim::mcu.adc.cfgr1)
+
+#define ADC_CR_ADEN					(1 << 0)
+#define ADC_CR_ADSTART				(1 << 2)
+#define ADC_CR_ADSTP				(1 << 4)
+
+#define ADC_CFGR1_OVRMOD			(1 << 12)
+#define ADC_CFGR1_EXTEN_RISING_EDGE	(0x1 << 10)
+#define ADC_CFGR1_EXTSEL_TIM3_TRGO	(0x3 << 6)
+
+#define ADC_CHANNEL_TEMP			16
+#define ADC_CHANNEL_VREF			17
+#define ADC_CHANNEL_VBAT			18
+
+#define ADC_CLKSOURCE_ADC			0
+#define ADC_CLKSOURCE_PCLK_DIV2		1
+#define ADC_CLKSOURCE_PCLK_DIV4		2
+
+#define ADC_SMPTIME_001DOT5			0x0
+#define ADC_SMPTIME_007DOT5			0x1
+#define ADC_SMPTIME_013DOT5			0x2
+#define ADC_SMPTIME_028DOT5			0x3
+#define ADC_SMPTIME_041DOT5			0x4
+#define ADC_SMPTIME_055DOT5			0x5
+#define ADC_SMPTIME_071DOT5			0x6
+#define ADC_SMPTIME_239DOT5			0x7
+
+#define ADC_RESOLUTION_12BIT		0x0
+#define ADC_RESOLUTION_10BIT		0x1
+#define ADC_RESOLUTION_8BIT			0x2
+#define ADC_RESOLUTION_6BIT			0x3
+
+enum adc_opmode {
+	ADC_MODE_SEQUENTIAL,
+	ADC_MODE_SCAN,
+	ADC_MODE_SCAN_INFINITE,
+};
+
+void adc_power_on(uint32_t adc);
+void adc_power_off(uint32_t adc);
+void adc_set_clk_source(uint32_t adc, uint32_t source);
+void adc_calibrate(uint32_t adc);
+void adc_set_operation_mode(uint32_t adc, enum adc_opmode opmode);
+void adc_enable_external_trigger_regular(uint32_t adc, uint32_t trigger, uint32_t polarity);
+void adc_disable_external_trigger_regular(uint32_t adc);
+void adc_set_right_aligned(uint32_t adc);
+void adc_enable_temperature_sensor(void);
+void adc_enable_vrefint(void);
+void adc_set_sample_time_on_all_channels(uint32_t adc, uint8_t time);
+void adc_set_regular_sequence(uint32_t adc, uint8_t length, uint8_t channel[]);
+void adc_enable_dma(uint32_t adc);
+void adc_disable_dma(uint32_t adc);
+void adc_enable_dma_circular_mode(uint32_t adc);
+void adc_disable_dma_circular_mode(uint32_t adc);
+void adc_set_resolution(uint32_t adc, uint16_t resolution);
+void adc_enable_analog_watchdog_on_all_channels(uint32_t adc);
+void adc_enable_analog_watchdog_on_selected_channel(uint32_t adc, uint8_t chan);
+void adc_disable_analog_watchdog(uint32_t adc);
+void adc_set_watchdog_high_threshold(uint32_t adc, uint16_t threshold);
+void adc_set_watchdog_low_threshold(uint32_t adc, uint16_t threshold);
+void adc_enable_watchdog_interrupt(uint32_t adc);
+void adc_disable_watchdog_interrupt(uint32_t adc);
+bool adc_get_watchdog_flag(uint32_t adc);
+void adc_clear_watchdog_flag(uint32_t adc);
+void adc_enable_autooff(uint32_t adc);
+void adc_disable_autooff(uint32_t adc);
+void adc_start_conversion_regular(uint32_t adc);
+void adc_enable_eoc_interrupt(uint32_t adc);
+void adc_disable_eoc_interrupt(uint32_t adc);
+bool adc_eoc(uint32_t adc);
+uint32_t adc_read_regular(uint32_t adc);
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define EXTI0						(1 << 0)
+#define EXTI1						(1 << 1)
+#define EXTI2						(1 << 2)
+#define EXTI3						(1 << 3)
+#define EXTI4						(1 << 4)
+#define EXTI5						(1 << 5)
+#define EXTI6						(1 << 6)
+#define EXTI7						(1 << 7)
+#define EXTI8						(1 << 8)
+#define EXTI9						(1 << 9)
+#define EXTI10						(1 << 10)
+#define EXTI11						(1 << 11)
+#define EXTI12						(1 << 12)
+#define EXTI13						(1 << 13)
+#define EXTI14						(1 << 14)
+#define EXTI15						(1 << 15)
+#define EXTI16						(1 << 16)
+#define EXTI17						(1 << 17)
+#define EXTI19						(1 << 19)
+#define EXTI20						(1 << 20)
+#define EXTI23						(1 << 23)
+
+#define EXTI_IMR					(Sim::mcu.exti.imr)
+#define EXTI_RTSR					(Sim::mcu.exti.rtsr)
+#define EXTI_FTSR					(Sim::mcu.exti.ftsr)
+#define EXTI_PR						(Sim::mcu.exti.pr)
+
+enum exti_trigger_type {
+	EXTI_TRIGGER_RISING,
+	EXTI_TRIGGER_FALLING,
+	EXTI_TRIGGER_BOTH,
+};
+
+void exti_set_trigger(uint32_t extis, enum exti_trigger_type trig);
+void exti_enable_request(uint32_t extis);
+void exti_disable_request(uint32_t extis);
+void exti_reset_request(uint32_t extis);
+void exti_select_source(uint32_t exti, uint32_t gpioport);
+uint32_t exti_get_flag_status(uint32_t exti);
@@ -0,0 +1,83 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define I2C1						0x40005400U
+
+namespace Sim {
+	uint32_t i2cCr1Read();
+	void i2cCr1Write(uint32_t value);
+};
+
+#define I2C_CR1(base)				(Sim::Register(Sim::i2cCr1Read, Sim::i2cCr1Write))
+#define I2C_CR2(base)				(Sim::mcu.i2c.cr2)
+#define I2C_OAR1(base)				(Sim::mcu.i2c.oar1)
+#define I2C_TIMINGR(base)			(Sim::mcu.i2c.timingr)
+#define I2C_ISR(base)				(Sim::mcu.i2c.isr)
+#define I2C_ICR(base)				(Sim::mcu.i2c.icr)
+#define I2C_RXDR(base)				(Sim::mcu.i2c.rxdr)
+#define I2C_TXDR(base)				(Sim::mcu.i2c.txdr)
+
+#define I2C_CR1_PE					(1 << 0)
+#define I2C_CR1_TXIE				(1 << 1)
+#define I2C_CR1_RXIE				(1 << 2)
+#define I2C_CR1_ADDRIE				(1 << 3)
+#define I2C_CR1_NACKIE				(1 << 4)
+#define I2C_CR1_STOPIE				(1 << 5)
+#define I2C_CR1_TCIE				(1 << 6)
+#define I2C_CR1_ERRIE				(1 << 7)
+#define I2C_CR1_DNF_SHIFT			8
+#define I2C_CR1_ANFOFF				(1 << 12)
+#define I2C_CR1_TXDMAEN				(1 << 14)
+#define I2C_CR1_RXDMAEN				(1 << 15)
+#define I2C_CR1_SBC					(1 << 16)
+#define I2C_CR1_NOSTRETCH			(1 << 17)
+#define I2C_CR1_WUPEN				(1 << 18)
+
+#define I2C_CR2_NACK				(1 << 15)
+#define I2C_CR2_AUTOEND				(1 << 25)
+
+#define I2C_OAR1_OA1EN_ENABLE		(1 << 15)
+
+#define I2C_TIMINGR_SCLL_SHIFT		0
+#define I2C_TIMINGR_SCLH_SHIFT		8
+#define I2C_TIMINGR_SDADEL_SHIFT	16
+#define I2C_TIMINGR_SCLDEL_SHIFT	20
+#define I2C_TIMINGR_PRESC_SHIFT		28
+
+#define I2C_ISR_TXE					(1 << 0)
+#define I2C_ISR_TXIS				(1 << 1)
+#define I2C_ISR_RXNE				(1 << 2)
+#define I2C_ISR_ADDR				(1 << 3)
+#define I2C_ISR_NACKF				(1 << 4)
+#define I2C_ISR_STOPF				(1 << 5)
+#define I2C_ISR_TC					(1 << 6)
+#define I2C_ISR_BERR				(1 << 8)
+#define I2C_ISR_ARLO				(1 << 9)
+#define I2C_ISR_OVR					(1 << 10)
+#define I2C_ISR_BUSY				(1 << 15)
+#define I2C_ISR_DIR_READ			(1 << 16)
+
+#define I2C_ICR_ADDRCF				(1 << 3)
+#define I2C_ICR_NACKCF				(1 << 4)
+#define I2C_ICR_STOPCF				(1 << 5)
+#define I2C_ICR_BERRCF				(1 << 8)
+#define I2C_ICR_ARLOCF				(1 << 9)
+#define I2C_ICR_OVRCF				(1 << 10)
+
+void i2c_peripheral_enable(uint32_t i2c);
+void i2c_peripheral_disable(uint32_t i2c);
+void i2c_enable_analog_filter(uint32_t i2c);
+void i2c_disable_analog_filter(uint32_t i2c);
+void i2c_set_digital_filter(uint32_t i2c, uint8_t dnf_setting);
+void i2c_set_prescaler(uint32_t i2c, uint8_t presc);
+void i2c_set_scl_low_period(uint32_t i2c, uint8_t period);
+void i2c_set_scl_high_period(uint32_t i2c, uint8_t period);
+void i2c_set_data_hold_time(uint32_t i2c, uint8_t h_time);
+void i2c_set_data_setup_time(uint32_t i2c, uint8_t s_time);
+void i2c_set_7bit_addr_mode(uint32_t i2c);
+void i2c_set_own_7bit_slave_address(uint32_t i2c, uint8_t slave);
+void i2c_enable_interrupt(uint32_t i2c, uint32_t interrupt);
+void i2c_disable_interrupt(uint32_t i2c, uint32_t interrupt);
+void i2c_enable_stretching(uint32_t i2c);
+void i2c_enable_autoend(uint32_t i2c);
@@ -0,0 +1,9 @@
+#pragma once
+
+#include <Mcu.h>
+
+void iwdg_start(void);
+void iwdg_set_period_ms(uint32_t period);
+bool iwdg_reload_busy(void);
+bool iwdg_prescaler_busy(void);
+void iwdg_reset(void);
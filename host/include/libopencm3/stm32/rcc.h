@@ -0,0 +1,59 @@
+#pragma once
+
+#include <Mcu.h>
+
+extern uint32_t rcc_ahb_frequency;
+extern uint32_t rcc_apb1_frequency;
+
+namespace Sim {
+	uint32_t rccCsrRead();
+	void rccCsrWrite(uint32_t value);
+};
+
+#define RCC_CSR						(Sim::Register(Sim::rccCsrRead, Sim::rccCsrWrite))
+#define RCC_CSR_LPWRRSTF			(1 << 31)
+#define RCC_CSR_WWDGRSTF			(1 << 30)
+#define RCC_CSR_IWDGRSTF			(1 << 29)
+#define RCC_CSR_SFTRSTF				(1 << 28)
+#define RCC_CSR_PORRSTF				(1 << 27)
+#define RCC_CSR_PINRSTF				(1 << 26)
+#define RCC_CSR_OBLRSTF				(1 << 25)
+#define RCC_CSR_RMVF				(1 << 24)
+#define RCC_CSR_RESET_FLAGS			(0xFE << 24)
+
+#define RCC_CFGR_PPRE_NODIV			0x0
+#define RCC_CFGR_PPRE_DIV2			0x4
+#define RCC_CFGR_PPRE_DIV4			0x5
+#define RCC_CFGR_HPRE_NODIV			0x0
+
+enum rcc_osc {
+	RCC_HSI14, RCC_HSI, RCC_HSE, RCC_PLL, RCC_LSI, RCC_LSE, RCC_HSI48
+};
+
+enum rcc_periph_clken {
+	RCC_DMA1, RCC_SRAM, RCC_FLTIF, RCC_CRC, RCC_GPIOA, RCC_GPIOB, RCC_GPIOC, RCC_GPIOD,
+	RCC_GPIOE, RCC_GPIOF, RCC_TSC, RCC_SYSCFG_COMP, RCC_ADC, RCC_TIM1, RCC_SPI1, RCC_TIM15,
+	RCC_TIM16, RCC_TIM17, RCC_USART1, RCC_DBGMCU, RCC_TIM2, RCC_TIM3, RCC_TIM6, RCC_TIM7,
+	RCC_TIM14, RCC_WWDG, RCC_SPI2, RCC_USART2, RCC_USART3, RCC_USART4, RCC_I2C1, RCC_I2C2,
+	RCC_USB, RCC_CAN, RCC_CRS, RCC_PWR, RCC_DAC, RCC_CEC, RCC_RTC
+};
+
+enum rcc_periph_rst {
+	RST_SYSCFG, RST_ADC, RST_TIM1, RST_SPI1, RST_USART1, RST_TIM15, RST_TIM16, RST_TIM17,
+	RST_DBGMCU, RST_TIM2, RST_TIM3, RST_TIM6, RST_TIM7, RST_TIM14, RST_WWDG, RST_SPI2,
+	RST_USART2, RST_USART3, RST_USART4, RST_I2C1, RST_I2C2, RST_USB, RST_CAN, RST_CRS,
+	RST_PWR, RST_DAC, RST_CEC
+};
+
+void rcc_periph_clock_enable(enum rcc_periph_clken clken);
+void rcc_periph_clock_disable(enum rcc_periph_clken clken);
+void rcc_periph_reset_pulse(enum rcc_periph_rst rst);
+void rcc_osc_on(enum rcc_osc osc);
+void rcc_osc_off(enum rcc_osc osc);
+void rcc_wait_for_osc_ready(enum rcc_osc osc);
+void rcc_set_rtc_clock_source(enum rcc_osc clk);
+void rcc_enable_rtc_clock(void);
+void rcc_set_ppre(uint32_t ppre);
+void rcc_set_hpre(uint32_t hpre);
+void rcc_set_i2c_clock_hsi(uint32_t i2c);
+void rcc_set_i2c_clock_sysclk(uint32_t i2c);
@@ -0,0 +1,114 @@
+#pragma once
+
+#include <Mcu.h>
+
+namespace Sim {
+	uint32_t rtcTrRead();
+	uint32_t rtcDrRead();
+	uint32_t rtcSsrRead();
+	uint32_t rtcCrRead();
+	void rtcCrWrite(uint32_t value);
+	void rtcReadOnly(uint32_t value);
+};
+
+#define RTC_TR						(Sim::Register(Sim::rtcTrRead, Sim::rtcReadOnly))
+#define RTC_DR						(Sim::Register(Sim::rtcDrRead, Sim::rtcReadOnly))
+#define RTC_SSR						(Sim::Register(Sim::rtcSsrRead, Sim::rtcReadOnly))
+#define RTC_CR						(Sim::Register(Sim::rtcCrRead, Sim::rtcCrWrite))
+#define RTC_ISR						(Sim::world->rtc_isr)
+#define RTC_PRER					(Sim::world->rtc_prer)
+#define RTC_ALRMAR					(Sim::world->rtc_alrmar)
+#define RTC_ALRMASSR				(Sim::world->rtc_alrmassr)
+#define RTC_BKPXR(reg)				(Sim::world->rtc_bkp[reg])
+
+#define RTC_TR_PM					(1 << 22)
+#define RTC_TR_HT_SHIFT				(20)
+#define RTC_TR_HT_MASK				(0x3)
+#define RTC_TR_HU_SHIFT				(16)
+#define RTC_TR_HU_MASK				(0xf)
+#define RTC_TR_MNT_SHIFT			(12)
+#define RTC_TR_MNT_MASK				(0x7)
+#define RTC_TR_MNU_SHIFT			(8)
+#define RTC_TR_MNU_MASK				(0xf)
+#define RTC_TR_ST_SHIFT				(4)
+#define RTC_TR_ST_MASK				(0x7)
+#define RTC_TR_SU_SHIFT				(0)
+#define RTC_TR_SU_MASK				(0xf)
+
+#define RTC_DR_YT_SHIFT				(20)
+#define RTC_DR_YT_MASK				(0xf)
+#define RTC_DR_YU_SHIFT				(16)
+#define RTC_DR_YU_MASK				(0xf)
+#define RTC_DR_WDU_SHIFT			(13)
+#define RTC_DR_WDU_MASK				(0x7)
+#define RTC_DR_MT_SHIFT				(12)
+#define RTC_DR_MT_MASK				(0x1)
+#define RTC_DR_MU_SHIFT				(8)
+#define RTC_DR_MU_MASK				(0xf)
+#define RTC_DR_DT_SHIFT				(4)
+#define RTC_DR_DT_MASK				(0x3)
+#define RTC_DR_DU_SHIFT				(0)
+#define RTC_DR_DU_MASK				(0xf)
+
+#define RTC_CR_WUCKSEL_SHIFT		(0)
+#define RTC_CR_WUCKSEL_MASK			(0x7)
+#define RTC_CR_FMT					(1 << 6)
+#define RTC_CR_ALRAE				(1 << 8)
+#define RTC_CR_WUTE					(1 << 10)
+#define RTC_CR_ALRAIE				(1 << 12)
+#define RTC_CR_WUTIE				(1 << 14)
+
+#define RTC_ISR_ALRAWF				(1 << 0)
+#define RTC_ISR_WUTWF				(1 << 2)
+#define RTC_ISR_INITS				(1 << 4)
+#define RTC_ISR_RSF					(1 << 5)
+#define RTC_ISR_INITF				(1 << 6)
+#define RTC_ISR_INIT				(1 << 7)
+#define RTC_ISR_ALRAF				(1 << 8)
+#define RTC_ISR_WUTF				(1 << 10)
+
+#define RTC_ALRMXR_MSK4				(1 << 31)
+#define RTC_ALRMXR_WDSEL			(1 << 30)
+#define RTC_ALRMXR_DT_SHIFT			(28)
+#define RTC_ALRMXR_DT_MASK			(0x3)
+#define RTC_ALRMXR_DU_SHIFT			(24)
+#define RTC_ALRMXR_DU_MASK			(0xf)
+#define RTC_ALRMXR_MSK3				(1 << 23)
+#define RTC_ALRMXR_PM				(1 << 22)
+#define RTC_ALRMXR_HT_SHIFT			(20)
+#define RTC_ALRMXR_HT_MASK			(0x3)
+#define RTC_ALRMXR_HU_SHIFT			(16)
+#define RTC_ALRMXR_HU_MASK			(0xf)
+#define RTC_ALRMXR_MSK2				(1 << 15)
+#define RTC_ALRMXR_MNT_SHIFT		(12)
+#define RTC_ALRMXR_MNT_MASK			(0x7)
+#define RTC_ALRMXR_MNU_SHIFT		(8)
+#define RTC_ALRMXR_MNU_MASK			(0xf)
+#define RTC_ALRMXR_MSK1				(1 << 7)
+#define RTC_ALRMXR_ST_SHIFT			(4)
+#define RTC_ALRMXR_ST_MASK			(0x7)
+#define RTC_ALRMXR_SU_SHIFT			(0)
+#define RTC_ALRMXR_SU_MASK			(0xf)
+
+#define RTC_ALRMXSSR_MASKSS_SHIFT	(24)
+#define RTC_ALRMXSSR_MASKSS_MASK	(0xf)
+#define RTC_ALRMXSSR_SS_SHIFT		(0)
+#define RTC_ALRMXSSR_SS_MASK		(0x7fff)
+
+void rtc_unlock(void);
+void rtc_lock(void);
+void rtc_set_init_flag(void);
+void rtc_clear_init_flag(void);
+bool rtc_init_flag_is_ready(void);
+void rtc_wait_for_init_ready(void);
+void rtc_wait_for_synchro(void);
+void rtc_set_prescaler(uint32_t sync, uint32_t async);
+void rtc_set_am_format(void);
+void rtc_set_pm_format(void);
+void rtc_enable_bypass_shadow_register(void);
+void rtc_disable_bypass_shadow_register(void);
+void rtc_calendar_set_year(uint8_t year);
+void rtc_calendar_set_weekday(uint8_t rtc_dr_wdu);
+void rtc_calendar_set_month(uint8_t rtc_dr_month);
+void rtc_calendar_set_day(uint8_t rtc_dr_day);
+void rtc_time_set_time(uint8_t hour, uint8_t minute, uint8_t second, bool use_am_notation);
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define SYSCFG_CFGR1					(Sim::mcu.syscfg.cfgr1)
+
+#define SYSCFG_CFGR1_I2C_FMP_PA9		(1 << 22)
+#define SYSCFG_CFGR1_I2C_FMP_PA10		(1 << 23)
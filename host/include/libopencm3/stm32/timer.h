@@ -0,0 +1,39 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define TIM3						0x40000400U
+#define TIM14						0x40002000U
+
+#define TIM_CR1_CKD_CK_INT			(0x0 << 8)
+#define TIM_CR1_CMS_EDGE			(0x0 << 5)
+#define TIM_CR1_DIR_UP				(0 << 4)
+
+#define TIM_CR2_MMS_UPDATE			(0x2 << 4)
+
+enum tim_oc_id {
+	TIM_OC1 = 0, TIM_OC1N, TIM_OC2, TIM_OC2N, TIM_OC3, TIM_OC3N, TIM_OC4
+};
+
+enum tim_oc_mode {
+	TIM_OCM_FROZEN, TIM_OCM_ACTIVE, TIM_OCM_INACTIVE, TIM_OCM_TOGGLE,
+	TIM_OCM_FORCE_LOW, TIM_OCM_FORCE_HIGH, TIM_OCM_PWM1, TIM_OCM_PWM2
+};
+
+void timer_set_mode(uint32_t timer_peripheral, uint32_t clock_div, uint32_t alignment, uint32_t direction);
+void timer_continuous_mode(uint32_t timer_peripheral);
+void timer_enable_break_main_output(uint32_t timer_peripheral);
+void timer_set_prescaler(uint32_t timer_peripheral, uint32_t value);
+void timer_set_period(uint32_t timer_peripheral, uint32_t period);
+void timer_set_counter(uint32_t timer_peripheral, uint32_t count);
+void timer_set_master_mode(uint32_t timer_peripheral, uint32_t mode);
+void timer_set_oc_mode(uint32_t timer_peripheral, enum tim_oc_id oc_id, enum tim_oc_mode oc_mode);
+void timer_enable_oc_preload(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_polarity_high(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_set_oc_value(uint32_t timer_peripheral, enum tim_oc_id oc_id, uint32_t value);
+void timer_enable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_disable_oc_output(uint32_t timer_peripheral, enum tim_oc_id oc_id);
+void timer_enable_preload(uint32_t timer_peripheral);
+void timer_disable_preload(uint32_t timer_peripheral);
+void timer_enable_counter(uint32_t timer_peripheral);
+void timer_disable_counter(uint32_t timer_peripheral);
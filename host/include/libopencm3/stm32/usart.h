@@ -0,0 +1,22 @@
+#pragma once
+
+#include <Mcu.h>
+
+#define USART1						0x40013800U
+#define USART2						0x40004400U
+
+#define USART_STOPBITS_1			0x0
+#define USART_PARITY_NONE			0x0
+#define USART_MODE_RX				0x4
+#define USART_MODE_TX				0x8
+#define USART_MODE_TX_RX			0xC
+#define USART_FLOWCONTROL_NONE		0x0
+
+void usart_set_baudrate(uint32_t usart, uint32_t baud);
+void usart_set_databits(uint32_t usart, uint32_t bits);
+void usart_set_stopbits(uint32_t usart, uint32_t stopbits);
+void usart_set_parity(uint32_t usart, uint32_t parity);
+void usart_set_mode(uint32_t usart, uint32_t mode);
+void usart_set_flow_control(uint32_t usart, uint32_t flowcontrol);
+void usart_enable(uint32_t usart);
+void usart_send_blocking(uint32_t usart, uint16_t data);
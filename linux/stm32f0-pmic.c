@@ -2,6 +2,7 @@
 #include <linux/kernel.h>
 #include <linux/interrupt.h>
 #include <linux/i2c.h>
+#include <linux/regmap.h>
 #include <linux/of.h>
 #include <linux/power_supply.h>
 #include <linux/rtc.h>
@@ -21,6 +22,19 @@
 #define PMIC_BAT_CHARGE_LOW_TEMP	(1 << 9)
 #define PMIC_BAT_CHARGE_HIGH_TEMP	(1 << 10)
 #define PMIC_PWR_KEY_PRESSED		(1 << 11)
+#define PMIC_RTC_ALARM				(1 << 15)
+
+// Events, only seen in PMIC_REG_IRQ_CHANGED: value moved out of its deadband
+#define PMIC_VBAT_MOVED				(1 << 16)
+#define PMIC_DCIN_MOVED				(1 << 17)
+#define PMIC_BAT_TEMP_MOVED			(1 << 18)
+#define PMIC_BAT_PCT_MOVED			(1 << 19)
+
+// Status bits behind the properties of each supply
+#define PMIC_DCIN_PSY_BITS			(PMIC_DCIN_GOOD | PMIC_DCIN_PRESENT | PMIC_DCIN_MOVED)
+#define PMIC_BAT_PSY_BITS			(PMIC_DCIN_GOOD | PMIC_BAT_PRESENT | PMIC_BAT_CHARGING | PMIC_BAT_CHARGE_EN | \
+									PMIC_BAT_LOW_TEMP | PMIC_BAT_HIGH_TEMP | PMIC_BAT_CHARGE_LOW_TEMP | PMIC_BAT_CHARGE_HIGH_TEMP | \
+									PMIC_VBAT_MOVED | PMIC_BAT_TEMP_MOVED | PMIC_BAT_PCT_MOVED)
 
 #define PMIC_REG_STATUS					0
 #define PMIC_REG_IRQ_STATUS				1
@@ -36,18 +50,68 @@
 #define PMIC_REG_POWER_OFF				11
 #define PMIC_REG_RTC_TIME				12
 #define PMIC_REG_PLAY_BUZZER			13
+#define PMIC_REG_SNAPSHOT				25
+#define PMIC_REG_IRQ_CHANGED			27
+#define PMIC_REG_RTC_ALARM				39
+
+#define PMIC_SNAPSHOT_VERSION			2
+
+static unsigned int cache_max_age_ms = 5000;
+module_param(cache_max_age_ms, uint, 0644);
+MODULE_PARM_DESC(cache_max_age_ms, "Max age of the cached telemetry without PMIC IRQ, ms");
+
+static unsigned int notify_interval_ms = 500;
+module_param(notify_interval_ms, uint, 0644);
+MODULE_PARM_DESC(notify_interval_ms, "Min interval between power supply change notifications, ms");
+
+// Burst read of PMIC_REG_SNAPSHOT
+struct stm32f0_pmic_snapshot {
+	u8 version;
+	u8 size;
+	__le16 seq;
+	__le32 status;
+	__le16 bat_voltage;
+	__le16 dcin_voltage;
+	__le32 bat_temp;
+	__le32 bat_pct;
+	__le32 cpu_temp;
+	__le32 rtc_time;
+	__le32 sample_age;
+} __packed;
+
+struct stm32f0_pmic_telemetry {
+	bool valid;
+	unsigned long updated;
+	u32 status;
+	s32 bat_voltage;
+	s32 dcin_voltage;
+	s32 bat_temp;
+	s32 bat_pct;
+	s32 cpu_temp;
+};
 
 struct stm32f0_pmic {
 	struct device *dev;
 	struct i2c_client *client;
+	struct regmap *regmap;
 	struct rtc_device *rtc;
-	struct mutex xfer_lock;
+	time64_t alarm_time;
+	
+	struct mutex cache_lock;
+	struct stm32f0_pmic_telemetry cache;
 	
 	int irq;
 	u32 beeper_volume;
 	
 	struct delayed_work work;
 	struct input_dev *input;
+	
+	struct mutex notify_lock;
+	bool irq_synced;		// under notify_lock, the probe work and the threaded IRQ both handle the IRQ
+	struct delayed_work notify_work;
+	unsigned long last_notify;
+	bool notify_dcin;
+	bool notify_bat;
 	struct input_dev *beeper;
 	
 	struct power_supply *psy_dcin;
@@ -60,29 +124,121 @@ static struct notifier_block pmic_restart_handler;
 /*
  * PMIC I2C
  * */
+// IRQ_STATUS and IRQ_CHANGED are cleared on read but stay readable for the IRQ handler,
+// they are safe from the debugfs register dump only because they are precious (see precious_reg)
+static bool stm32f0_pmic_readable_reg(struct device *dev, unsigned int reg) {
+	switch (reg) {
+		case PMIC_REG_POWER_OFF:
+		case PMIC_REG_PLAY_BUZZER:
+			return false;
+	}
+	return true;
+}
+
+static bool stm32f0_pmic_writeable_reg(struct device *dev, unsigned int reg) {
+	switch (reg) {
+		case PMIC_REG_POWER_OFF:
+		case PMIC_REG_RTC_TIME:
+		case PMIC_REG_PLAY_BUZZER:
+		case PMIC_REG_RTC_ALARM:
+			return true;
+	}
+	return false;
+}
+
+static bool stm32f0_pmic_volatile_reg(struct device *dev, unsigned int reg) {
+	switch (reg) {
+		// Constants
+		case PMIC_REG_BAT_MIN_TEMP:
+		case PMIC_REG_BAT_MAX_TEMP:
+		case PMIC_REG_GET_MAX_BAT_VOLTAGE:
+		case PMIC_REG_GET_MIN_BAT_VOLTAGE:
+			return false;
+	}
+	return true;
+}
+
+static bool stm32f0_pmic_precious_reg(struct device *dev, unsigned int reg) {
+	// Read acknowledges the IRQ, IRQ_CHANGED is also cleared. Keeps them out of the debugfs dump.
+	return reg == PMIC_REG_IRQ_STATUS || reg == PMIC_REG_IRQ_CHANGED;
+}
+
+static bool stm32f0_pmic_readable_noinc_reg(struct device *dev, unsigned int reg) {
+	return reg == PMIC_REG_SNAPSHOT;
+}
+
+static const struct regmap_config stm32f0_pmic_regmap_config = {
+	.reg_bits			= 8,
+	.val_bits			= 32,
+	.val_format_endian	= REGMAP_ENDIAN_LITTLE,
+	.max_register		= PMIC_REG_RTC_ALARM,
+	.readable_reg		= stm32f0_pmic_readable_reg,
+	.writeable_reg		= stm32f0_pmic_writeable_reg,
+	.volatile_reg		= stm32f0_pmic_volatile_reg,
+	.precious_reg		= stm32f0_pmic_precious_reg,
+	.readable_noinc_reg	= stm32f0_pmic_readable_noinc_reg,
+	.cache_type			= REGCACHE_RBTREE,
+};
+
 static u32 stm32f0_pmic_read(struct stm32f0_pmic *pmic, u8 reg, s32 *ret) {
-	u32 data = 0;
-	s32 readed;
+	unsigned int data = 0;
+	*ret = regmap_read(pmic->regmap, reg, &data);
+	return data;
+}
+
+static s32 stm32f0_pmic_write(struct stm32f0_pmic *pmic, u8 reg, u32 data) {
+	return regmap_write(pmic->regmap, reg, data);
+}
+
+/*
+ * Telemetry cache
+ * */
+static int stm32f0_pmic_read_snapshot(struct stm32f0_pmic *pmic, struct stm32f0_pmic_telemetry *telemetry) {
+	struct stm32f0_pmic_snapshot snapshot;
+	int ret;
+	
+	// All values in one transfer, the register is not auto-incremented
+	ret = regmap_noinc_read(pmic->regmap, PMIC_REG_SNAPSHOT, &snapshot, sizeof(snapshot));
+	if (ret)
+		return ret;
+	
+	if (snapshot.version < PMIC_SNAPSHOT_VERSION || snapshot.size < sizeof(snapshot)) {
+		dev_err_ratelimited(pmic->dev, "unsupported snapshot v%d, size %d\n", snapshot.version, snapshot.size);
+		return -EPROTO;
+	}
 	
-	mutex_lock(&pmic->xfer_lock);
-	readed = i2c_smbus_read_i2c_block_data(pmic->client, reg, 4, (u8 *) &data);
-	*ret = (readed == 4 ? 0 : -EIO);
-	mutex_unlock(&pmic->xfer_lock);
+	telemetry->status = le32_to_cpu(snapshot.status);
+	telemetry->bat_voltage = le16_to_cpu(snapshot.bat_voltage);
+	telemetry->dcin_voltage = le16_to_cpu(snapshot.dcin_voltage);
+	telemetry->bat_temp = (s32) le32_to_cpu(snapshot.bat_temp);
+	telemetry->bat_pct = (s32) le32_to_cpu(snapshot.bat_pct);
+	telemetry->cpu_temp = (s32) le32_to_cpu(snapshot.cpu_temp);
+	telemetry->updated = jiffies;
+	telemetry->valid = true;
 	
-	return le32_to_cpu(data);
+	return 0;
 }
 
-static s32 stm32f0_pmic_write(struct stm32f0_pmic *pmic, u8 reg, u32 data) {
-	s32 ret;
+// Served from the cache until the PMIC IRQ or cache_max_age_ms
+static int stm32f0_pmic_get_telemetry(struct stm32f0_pmic *pmic, struct stm32f0_pmic_telemetry *telemetry) {
+	int ret = 0;
 	
-	mutex_lock(&pmic->xfer_lock);
-	data = cpu_to_le32(data);
-	ret = i2c_smbus_write_i2c_block_data(pmic->client, reg, 4, (u8 *) &data);
-	mutex_unlock(&pmic->xfer_lock);
+	mutex_lock(&pmic->cache_lock);
+	if (!pmic->cache.valid || time_after(jiffies, pmic->cache.updated + msecs_to_jiffies(cache_max_age_ms)))
+		ret = stm32f0_pmic_read_snapshot(pmic, &pmic->cache);
+	if (!ret)
+		*telemetry = pmic->cache;
+	mutex_unlock(&pmic->cache_lock);
 	
 	return ret;
 }
 
+static void stm32f0_pmic_invalidate_telemetry(struct stm32f0_pmic *pmic) {
+	mutex_lock(&pmic->cache_lock);
+	pmic->cache.valid = false;
+	mutex_unlock(&pmic->cache_lock);
+}
+
 /*
  * Restart & Reboot
  * */
@@ -133,12 +289,46 @@ static int stm32f0_pmic_rtc_set_time(struct device *dev, struct rtc_time *tm) {
 	return stm32f0_pmic_write(pmic, PMIC_REG_RTC_TIME, rtc_tm_to_time64(tm));
 }
 
+// PMIC keeps only the enabled alarm, 0 - disabled
+static int stm32f0_pmic_rtc_read_alarm(struct device *dev, struct rtc_wkalrm *alrm) {
+	struct stm32f0_pmic *pmic = dev_get_drvdata(dev);
+	s32 ret = 0;
+	u32 time = stm32f0_pmic_read(pmic, PMIC_REG_RTC_ALARM, &ret);
+	
+	if (ret)
+		return ret;
+	
+	if (time)
+		pmic->alarm_time = time;
+	
+	alrm->enabled = time != 0;
+	rtc_time64_to_tm(pmic->alarm_time, &alrm->time);
+	return 0;
+}
+
+static int stm32f0_pmic_rtc_set_alarm(struct device *dev, struct rtc_wkalrm *alrm) {
+	struct stm32f0_pmic *pmic = dev_get_drvdata(dev);
+	pmic->alarm_time = rtc_tm_to_time64(&alrm->time);
+	return stm32f0_pmic_write(pmic, PMIC_REG_RTC_ALARM, alrm->enabled ? pmic->alarm_time : 0);
+}
+
+static int stm32f0_pmic_rtc_alarm_irq_enable(struct device *dev, unsigned int enabled) {
+	struct stm32f0_pmic *pmic = dev_get_drvdata(dev);
+	return stm32f0_pmic_write(pmic, PMIC_REG_RTC_ALARM, enabled ? pmic->alarm_time : 0);
+}
+
 static const struct rtc_class_ops stm32f0_pmic_rtc_ops = {
-	.read_time	= stm32f0_pmic_rtc_read_time,
-	.set_time	= stm32f0_pmic_rtc_set_time,
+	.read_time			= stm32f0_pmic_rtc_read_time,
+	.set_time			= stm32f0_pmic_rtc_set_time,
+	.read_alarm			= stm32f0_pmic_rtc_read_alarm,
+	.set_alarm			= stm32f0_pmic_rtc_set_alarm,
+	.alarm_irq_enable	= stm32f0_pmic_rtc_alarm_irq_enable,
 };
 
 static int stm32f0_pmic_register_rtc(struct stm32f0_pmic *pmic) {
+	// Alarm powers on the system, the RTC core exposes wakealarm for wakeup capable devices
+	device_init_wakeup(pmic->dev, true);
+	
 	pmic->rtc = devm_rtc_device_register(pmic->dev, "stm32f0-pmic", &stm32f0_pmic_rtc_ops, THIS_MODULE);
 	return PTR_ERR_OR_ZERO(pmic->rtc);
 }
@@ -276,31 +466,95 @@ static void stm32f0_pmic_unregister_beeper(struct stm32f0_pmic *pmic) {
 /*
  * PMIC
  * */
-static void stm32f0_pmic_delayed_func(struct work_struct *_work) {
-	struct stm32f0_pmic *pmic = container_of(_work, struct stm32f0_pmic, work.work);
+static void stm32f0_pmic_flush_notify(struct stm32f0_pmic *pmic) {
+	if (!pmic->notify_dcin && !pmic->notify_bat)
+		return;
+	
+	if (pmic->notify_dcin)
+		power_supply_changed(pmic->psy_dcin);
+	if (pmic->notify_bat)
+		power_supply_changed(pmic->psy_bat);
+	
+	pmic->notify_dcin = false;
+	pmic->notify_bat = false;
+	pmic->last_notify = jiffies;
+}
+
+static void stm32f0_pmic_notify_func(struct work_struct *_work) {
+	struct stm32f0_pmic *pmic = container_of(_work, struct stm32f0_pmic, notify_work.work);
+	
+	mutex_lock(&pmic->notify_lock);
+	stm32f0_pmic_flush_notify(pmic);
+	mutex_unlock(&pmic->notify_lock);
+}
+
+// Bouncing inputs are coalesced into one notification per notify_interval_ms
+static void stm32f0_pmic_notify(struct stm32f0_pmic *pmic, bool dcin, bool bat) {
+	unsigned long next;
 	
+	if (!dcin && !bat)
+		return;
+	
+	mutex_lock(&pmic->notify_lock);
+	pmic->notify_dcin |= dcin;
+	pmic->notify_bat |= bat;
+	
+	next = pmic->last_notify + msecs_to_jiffies(notify_interval_ms);
+	if (time_after(next, jiffies)) {
+		schedule_delayed_work(&pmic->notify_work, next - jiffies);
+	} else {
+		stm32f0_pmic_flush_notify(pmic);
+	}
+	mutex_unlock(&pmic->notify_lock);
+}
+
+static void stm32f0_pmic_handle_irq(struct stm32f0_pmic *pmic) {
 	s32 ret;
-	u32 irq;
+	u32 irq = 0;
+	u32 changed;
 	
-	irq = stm32f0_pmic_read(pmic, PMIC_REG_IRQ_STATUS, &ret);
+	stm32f0_pmic_invalidate_telemetry(pmic);
+	
+	// Latched by the firmware until read, so toggled back bits and the events are not lost
+	changed = stm32f0_pmic_read(pmic, PMIC_REG_IRQ_CHANGED, &ret);
+	if (ret == 0)
+		irq = stm32f0_pmic_read(pmic, PMIC_REG_IRQ_STATUS, &ret);
 	if (ret != 0) {
 		input_report_key(pmic->input, KEY_POWER, false);
 		input_sync(pmic->input);
 		
-		dev_err(pmic->dev, "can not read PMIC_REG_IRQ_STATUS\n");
+		dev_err(pmic->dev, "can not read PMIC IRQ registers\n");
 		return;
 	}
 	
 	input_report_key(pmic->input, KEY_POWER, (irq & PMIC_PWR_KEY_PRESSED) != 0);
 	input_sync(pmic->input);
 	
-	power_supply_changed(pmic->psy_dcin);
-	power_supply_changed(pmic->psy_bat);
+	// Only the supplies whose properties depend on the changed bits, both after probe
+	mutex_lock(&pmic->notify_lock);
+	if (!pmic->irq_synced) {
+		changed = ~0;
+		pmic->irq_synced = true;
+	}
+	mutex_unlock(&pmic->notify_lock);
+	
+	stm32f0_pmic_notify(pmic, (changed & PMIC_DCIN_PSY_BITS) != 0, (changed & PMIC_BAT_PSY_BITS) != 0);
+	
+	// Also after probe, if the alarm powered on the system
+	if ((changed & irq & PMIC_RTC_ALARM))
+		rtc_update_irq(pmic->rtc, 1, RTC_IRQF | RTC_AF);
+}
+
+// Initial state after probe
+static void stm32f0_pmic_delayed_func(struct work_struct *_work) {
+	struct stm32f0_pmic *pmic = container_of(_work, struct stm32f0_pmic, work.work);
+	stm32f0_pmic_handle_irq(pmic);
 }
 
+// Threaded half, may sleep on I2C
 static irqreturn_t stm32f0_pmic_isr_func(int irq, void *ptr) {
 	struct stm32f0_pmic *pmic = ptr;
-	schedule_delayed_work(&pmic->work, msecs_to_jiffies(0));
+	stm32f0_pmic_handle_irq(pmic);
 	return IRQ_HANDLED;
 }
 
@@ -309,6 +563,9 @@ static int stm32f0_pmic_setup_irq(struct stm32f0_pmic *pmic) {
 	int irq = pmic->client->irq;
 	
 	INIT_DELAYED_WORK(&pmic->work, stm32f0_pmic_delayed_func);
+	INIT_DELAYED_WORK(&pmic->notify_work, stm32f0_pmic_notify_func);
+	mutex_init(&pmic->notify_lock);
+	pmic->last_notify = jiffies - msecs_to_jiffies(notify_interval_ms);
 	
 	if (irq <= 0) {
 		dev_warn(pmic->dev, "invalid irq number: %d\n", irq);
@@ -328,6 +585,7 @@ static void stm32f0_pmic_release_irq(struct stm32f0_pmic *pmic) {
 	cancel_delayed_work_sync(&pmic->work);
 	if (pmic->irq)
 		free_irq(pmic->irq, pmic);
+	cancel_delayed_work_sync(&pmic->notify_work);
 }
 
 static enum power_supply_property stm32f0_pmic_charger_prop[] = {
@@ -355,22 +613,28 @@ static char *battery_supplied_to[] = {
 
 static int stm32f0_pmic_charger_get_property(struct power_supply *psy, enum power_supply_property psp, union power_supply_propval *val) {
 	struct stm32f0_pmic *pmic = dev_get_drvdata(psy->dev.parent);
-	s32 ret = 0;
+	struct stm32f0_pmic_telemetry telemetry;
+	s32 ret;
+	
+	ret = stm32f0_pmic_get_telemetry(pmic, &telemetry);
+	if (ret)
+		return ret;
+	
 	switch (psp) {
 		case POWER_SUPPLY_PROP_ONLINE:
-			val->intval = (stm32f0_pmic_read(pmic, PMIC_REG_STATUS, &ret) & PMIC_DCIN_GOOD) ? 1 : 0;
+			val->intval = (telemetry.status & PMIC_DCIN_GOOD) ? 1 : 0;
 		break;
 		
 		case POWER_SUPPLY_PROP_PRESENT:
-			val->intval = (stm32f0_pmic_read(pmic, PMIC_REG_STATUS, &ret) & PMIC_DCIN_PRESENT) ? 1 : 0;
+			val->intval = (telemetry.status & PMIC_DCIN_PRESENT) ? 1 : 0;
 		break;
 		
 		case POWER_SUPPLY_PROP_VOLTAGE_NOW:
-			val->intval = (s32) stm32f0_pmic_read(pmic, PMIC_REG_DCIN_VOLTAGE, &ret) * 1000;
+			val->intval = telemetry.dcin_voltage * 1000;
 		break;
 		
 		case POWER_SUPPLY_PROP_TEMP:
-			val->intval = (s32) stm32f0_pmic_read(pmic, PMIC_REG_CPU_TEMP, &ret) / 100;
+			val->intval = telemetry.cpu_temp / 100;
 		break;
 		
 		default:
@@ -383,19 +647,25 @@ static int stm32f0_pmic_charger_get_property(struct power_supply *psy, enum powe
 
 static int stm32f0_pmic_battery_get_property(struct power_supply *psy, enum power_supply_property psp, union power_supply_propval *val) {
 	struct stm32f0_pmic *pmic = dev_get_drvdata(psy->dev.parent);
+	struct stm32f0_pmic_telemetry telemetry;
 	u32 tmp;
-	s32 ret = 0;
+	s32 ret;
+	
+	ret = stm32f0_pmic_get_telemetry(pmic, &telemetry);
+	if (ret)
+		return ret;
+	
 	switch (psp) {
 		case POWER_SUPPLY_PROP_ONLINE:
-			val->intval = (stm32f0_pmic_read(pmic, PMIC_REG_STATUS, &ret) & PMIC_DCIN_GOOD) ? 0 : 1;
+			val->intval = (telemetry.status & PMIC_DCIN_GOOD) ? 0 : 1;
 		break;
 		
 		case POWER_SUPPLY_PROP_PRESENT:
-			val->intval = (stm32f0_pmic_read(pmic, PMIC_REG_STATUS, &ret) & PMIC_BAT_PRESENT) ? 1 : 0;
+			val->intval = (telemetry.status & PMIC_BAT_PRESENT) ? 1 : 0;
 		break;
 		
 		case POWER_SUPPLY_PROP_STATUS:
-			tmp = stm32f0_pmic_read(pmic, PMIC_REG_STATUS, &ret);
+			tmp = telemetry.status;
 			
 			if ((tmp & PMIC_DCIN_GOOD)) {
 				if ((tmp & PMIC_BAT_CHARGE_EN)) {
@@ -409,7 +679,7 @@ static int stm32f0_pmic_battery_get_property(struct power_supply *psy, enum powe
 		break;
 		
 		case POWER_SUPPLY_PROP_HEALTH:
-			tmp = stm32f0_pmic_read(pmic, PMIC_REG_STATUS, &ret);
+			tmp = telemetry.status;
 			
 			if ((tmp & (PMIC_BAT_HIGH_TEMP | PMIC_BAT_CHARGE_HIGH_TEMP))) {
 				val->intval = POWER_SUPPLY_HEALTH_OVERHEAT;
@@ -429,15 +699,15 @@ static int stm32f0_pmic_battery_get_property(struct power_supply *psy, enum powe
 		break;
 		
 		case POWER_SUPPLY_PROP_VOLTAGE_NOW:
-			val->intval = (s32) stm32f0_pmic_read(pmic, PMIC_REG_BAT_VOLTAGE, &ret) * 1000;
+			val->intval = telemetry.bat_voltage * 1000;
 		break;
 		
 		case POWER_SUPPLY_PROP_CAPACITY:
-			val->intval = (s32) stm32f0_pmic_read(pmic, PMIC_REG_BAT_PCT, &ret) / 1000;
+			val->intval = telemetry.bat_pct / 1000;
 		break;
 		
 		case POWER_SUPPLY_PROP_TEMP:
-			val->intval = (s32) stm32f0_pmic_read(pmic, PMIC_REG_BAT_TEMP, &ret) / 100;
+			val->intval = telemetry.bat_temp / 100;
 		break;
 		
 		case POWER_SUPPLY_PROP_TECHNOLOGY:
@@ -539,7 +809,13 @@ static int stm32f0_pmic_probe(struct i2c_client *i2c_client) {
 	pmic->dev = &i2c_client->dev;
 	i2c_set_clientdata(i2c_client, pmic);
 	
-	mutex_init(&pmic->xfer_lock);
+	mutex_init(&pmic->cache_lock);
+	
+	pmic->regmap = devm_regmap_init_i2c(i2c_client, &stm32f0_pmic_regmap_config);
+	if (IS_ERR(pmic->regmap)) {
+		dev_err(pmic->dev, "regmap init err: %ld", PTR_ERR(pmic->regmap));
+		return PTR_ERR(pmic->regmap);
+	}
 	
 	ret = stm32f0_pmic_register_psy(pmic);
 	if (ret) {
@@ -553,18 +829,19 @@ static int stm32f0_pmic_probe(struct i2c_client *i2c_client) {
 		return ret;
 	}
 	
-	ret = stm32f0_pmic_setup_irq(pmic);
+	// The IRQ handler reports to the input device
+	ret = stm32f0_pmic_register_input(pmic);
 	if (ret) {
-		dev_err(pmic->dev, "irq handler err: %d", ret);
+		dev_err(pmic->dev, "pwr key err: %d", ret);
 		stm32f0_pmic_unregister_psy(pmic);
 		return ret;
 	}
 	
-	ret = stm32f0_pmic_register_input(pmic);
+	ret = stm32f0_pmic_setup_irq(pmic);
 	if (ret) {
-		dev_err(pmic->dev, "pwr key err: %d", ret);
+		dev_err(pmic->dev, "irq handler err: %d", ret);
 		stm32f0_pmic_unregister_psy(pmic);
-		stm32f0_pmic_release_irq(pmic);
+		stm32f0_pmic_unregister_input(pmic);
 		return ret;
 	}
 	
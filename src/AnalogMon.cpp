@@ -4,6 +4,7 @@
 #include <algorithm>
 #include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/timer.h>
 
 static AnalogMon *m_instance = nullptr;
 
@@ -22,35 +23,304 @@ void AnalogMon::init() {
 	
 	rcc_periph_clock_enable(RCC_ADC);
 	rcc_periph_clock_enable(RCC_DMA1);
+	rcc_periph_clock_enable(RCC_TIM3);
 	
 	// ADC
 	adc_power_off(ADC1);
 	adc_set_clk_source(ADC1, ADC_CLKSOURCE_ADC);
 	adc_calibrate(ADC1);
-	adc_set_operation_mode(ADC1, ADC_MODE_SCAN);
-	adc_disable_external_trigger_regular(ADC1);
 	adc_set_right_aligned(ADC1);
 	adc_enable_temperature_sensor();
 	adc_enable_vrefint();
 	adc_set_sample_time_on_all_channels(ADC1, ADC_SMPTIME_239DOT5);
-	adc_set_regular_sequence(ADC1, COUNT_OF(m_adc_channels), (uint8_t *) m_adc_channels);
-	adc_enable_dma(ADC1);
-	adc_enable_dma_circular_mode(ADC1);
 	adc_set_resolution(ADC1, ADC_RESOLUTION_12BIT);
-	adc_disable_analog_watchdog(ADC1);
+	adc_disable_dma_circular_mode(ADC1);
 	
-	// DMA
-	dma_enable_mem2mem_mode(DMA1, DMA_CHANNEL1);
+	// The single-channel watch never reads DR, let the data be overwritten
+	ADC_CFGR1(ADC1) |= ADC_CFGR1_OVRMOD;
+	
+	nvic_enable_irq(NVIC_ADC_COMP_IRQ);
+	
+	// TIM3, TRGO on update starts the watch and capture scans, the period is set by each of them
+	static_assert(Config::ADC_WATCH_INTERVAL > 0 && Config::ADC_WATCH_INTERVAL * (TIM3_CLOCK / 1000) <= 0x10000, "Invalid ADC_WATCH_INTERVAL");
+	static_assert(Config::ADC_CAPTURE_RATE > 0 && Config::ADC_CAPTURE_RATE <= 20000 && TIM3_CLOCK % Config::ADC_CAPTURE_RATE == 0, "Invalid ADC_CAPTURE_RATE");
+	rcc_periph_reset_pulse(RST_TIM3);
+	timer_set_mode(TIM3, TIM_CR1_CKD_CK_INT, TIM_CR1_CMS_EDGE, TIM_CR1_DIR_UP);
+	timer_continuous_mode(TIM3);
+	timer_set_prescaler(TIM3, rcc_apb1_frequency / TIM3_CLOCK - 1);
+	timer_set_master_mode(TIM3, TIM_CR2_MMS_UPDATE);
+	
+	// DMA, one-shot: ADC stops converting when the buffer is full
 	dma_set_memory_size(DMA1, DMA_CHANNEL1, DMA_CCR_MSIZE_16BIT);
 	dma_set_peripheral_size(DMA1, DMA_CHANNEL1, DMA_CCR_PSIZE_16BIT);
 	dma_enable_memory_increment_mode(DMA1, DMA_CHANNEL1);
 	dma_set_read_from_peripheral(DMA1, DMA_CHANNEL1);
-	dma_set_peripheral_address(DMA1, DMA_CHANNEL1, reinterpret_cast<uint32_t>(&ADC_DR(ADC1)));
-	dma_set_memory_address(DMA1, DMA_CHANNEL1, reinterpret_cast<uint32_t>(&m_adc_result));
-	dma_set_number_of_data(DMA1, DMA_CHANNEL1, COUNT_OF(m_adc_result));
-	dma_enable_circular_mode(DMA1, DMA_CHANNEL1);
+	dma_set_peripheral_address(DMA1, DMA_CHANNEL1, reinterpret_cast<uintptr_t>(&ADC_DR(ADC1)));
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, reinterpret_cast<uintptr_t>(&m_adc_buffer));
 	dma_enable_transfer_complete_interrupt(DMA1, DMA_CHANNEL1);
 	nvic_enable_irq(NVIC_DMA1_CHANNEL1_IRQ);
+	
+	m_done_event.init(Event::Callback::make<&AnalogMon::onDone>(*this));
+	m_watch_event.init(Event::Callback::make<&AnalogMon::onWatchAlert>(*this));
+	m_capture_event.init(Event::Callback::make<&AnalogMon::onCaptureDone>(*this));
+}
+
+void AnalogMon::setupRead() {
+	adc_set_operation_mode(ADC1, ADC_MODE_SCAN_INFINITE);
+	adc_disable_external_trigger_regular(ADC1);
+	adc_disable_autooff(ADC1);
+	adc_disable_analog_watchdog(ADC1);
+	adc_disable_watchdog_interrupt(ADC1);
+	adc_set_regular_sequence(ADC1, COUNT_OF(m_adc_channels), (uint8_t *) m_adc_channels);
+	adc_enable_dma(ADC1);
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, reinterpret_cast<uintptr_t>(&m_adc_buffer));
+}
+
+void AnalogMon::setWatch(bool enable) {
+	if (m_watch == enable)
+		return;
+	
+	m_watch = enable;
+	
+	// Running read or capture arms it when done
+	if (m_busy || m_capture_armed)
+		return;
+	
+	if (enable) {
+		armWatch();
+	} else {
+		disarmWatch();
+		switchFormAdcToExti(true);
+	}
+}
+
+void AnalogMon::armWatch() {
+	// Value already below its threshold would fire right away
+	bool watch_dcin = m_dcin_present && !m_ignore_dcin && !m_dcin_ignore_window && m_dcin > Config::ADC_WATCH_DCIN_MIN;
+	bool watch_vbat = m_vbat > Config::ADC_WATCH_VBAT_MIN;
+	
+	if (!watch_dcin && !watch_vbat)
+		return;
+	
+	m_watch_channels_cnt = 0;
+	
+	if (watch_dcin) {
+		m_watch_channels[m_watch_channels_cnt++] = {Pinout::ADC_CH_DCIN, static_cast<uint16_t>(getWatchThreshold(Config::ADC_WATCH_DCIN_MIN, Config::DCIN_RDIV))};
+		Exti::disable(Pinout::DCIN_ADC.port, Pinout::DCIN_ADC.pin);
+		gpio_mode_setup(Pinout::DCIN_ADC.port, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, Pinout::DCIN_ADC.pin);
+	}
+	
+	if (watch_vbat) {
+		m_watch_channels[m_watch_channels_cnt++] = {Pinout::ADC_CH_VBAT, static_cast<uint16_t>(getWatchThreshold(Config::ADC_WATCH_VBAT_MIN, Config::VBAT_RDIV))};
+		Exti::disable(Pinout::VBAT_ADC.port, Pinout::VBAT_ADC.pin);
+		gpio_mode_setup(Pinout::VBAT_ADC.port, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, Pinout::VBAT_ADC.pin);
+	}
+	
+	// ADC and TIM3 are not clocked in STOP
+	Loop::lockStop();
+	m_watch_armed = true;
+	
+	// One conversion per TIM3 trigger, ADC is powered only during the conversion
+	adc_set_operation_mode(ADC1, ADC_MODE_SCAN);
+	adc_disable_dma(ADC1);
+	adc_enable_external_trigger_regular(ADC1, ADC_CFGR1_EXTSEL_TIM3_TRGO, ADC_CFGR1_EXTEN_RISING_EDGE);
+	adc_set_watchdog_high_threshold(ADC1, 4095);
+	adc_clear_watchdog_flag(ADC1);
+	adc_enable_watchdog_interrupt(ADC1);
+	
+	adc_power_on(ADC1);
+	adc_enable_autooff(ADC1);
+	
+	m_watch_channel_idx = 0;
+	selectWatchChannel(0);
+	
+	// EOC of each conversion switches to the other channel
+	if (m_watch_channels_cnt > 1) {
+		adc_read_regular(ADC1);
+		adc_enable_eoc_interrupt(ADC1);
+	}
+	
+	// Each channel is still converted every ADC_WATCH_INTERVAL
+	timer_set_period(TIM3, Config::ADC_WATCH_INTERVAL * (TIM3_CLOCK / 1000) / m_watch_channels_cnt - 1);
+	timer_set_counter(TIM3, 0);
+	timer_enable_counter(TIM3);
+}
+
+// Called from the ADC ISR too, CHSELR and CFGR1 are writable only with the conversion stopped
+void AnalogMon::selectWatchChannel(uint8_t index) {
+	const WatchChannel &watch = m_watch_channels[index];
+	
+	if ((ADC_CR(ADC1) & ADC_CR_ADSTART)) {
+		ADC_CR(ADC1) |= ADC_CR_ADSTP;
+		while ((ADC_CR(ADC1) & ADC_CR_ADSTART));
+	}
+	
+	uint8_t channel = watch.channel;
+	adc_set_regular_sequence(ADC1, 1, &channel);
+	adc_enable_analog_watchdog_on_selected_channel(ADC1, channel);
+	adc_set_watchdog_low_threshold(ADC1, watch.threshold);
+	adc_start_conversion_regular(ADC1);
+}
+
+// Lowest raw value above the voltage, the watchdog flag is raised below it
+int AnalogMon::getWatchThreshold(int voltage, int rdiv) {
+	int raw = toRaw(voltage, m_vref, rdiv);
+	while (raw < 4095 && toVoltage(raw, m_vref, rdiv) <= voltage)
+		raw++;
+	return raw;
+}
+
+void AnalogMon::disarmWatch() {
+	if (!m_watch_armed)
+		return;
+	
+	timer_disable_counter(TIM3);
+	adc_disable_watchdog_interrupt(ADC1);
+	adc_disable_eoc_interrupt(ADC1);
+	adc_power_off(ADC1);
+	
+	m_watch_armed = false;
+	Loop::unlockStop();
+}
+
+void AnalogMon::onWatchAlert(void *, uint32_t) {
+	if (m_watch_callback)
+		m_watch_callback(m_watch_user_data);
+}
+
+bool AnalogMon::startCapture(Value channel, CaptureTrigger trigger, int threshold) {
+	if ((channel != DCIN && channel != VBAT) || trigger < CAPTURE_NOW || trigger > CAPTURE_ABOVE)
+		return false;
+	
+	stopCapture();
+	
+	m_capture_channel = channel;
+	m_capture_trigger = trigger;
+	m_capture_threshold = threshold;
+	m_capture_state = CAPTURE_ARMED;
+	
+	// Running read arms it when done
+	if (!m_busy)
+		armCapture();
+	
+	return true;
+}
+
+void AnalogMon::stopCapture() {
+	bool was_armed = m_capture_armed;
+	m_capture_state = CAPTURE_IDLE;
+	if (was_armed)
+		releaseCapture();
+}
+
+int AnalogMon::getCaptureRdiv() {
+	return m_capture_channel == DCIN ? Config::DCIN_RDIV : Config::VBAT_RDIV;
+}
+
+void AnalogMon::armCapture() {
+	const Pinout::Pin &pin = m_capture_channel == DCIN ? Pinout::DCIN_ADC : Pinout::VBAT_ADC;
+	
+	disarmWatch();
+	Exti::disable(pin.port, pin.pin);
+	gpio_mode_setup(pin.port, GPIO_MODE_ANALOG, GPIO_PUPD_NONE, pin.pin);
+	
+	// ADC and TIM3 are not clocked in STOP
+	Loop::lockStop();
+	m_capture_armed = true;
+	
+	// One conversion per TIM3 trigger
+	adc_set_operation_mode(ADC1, ADC_MODE_SCAN);
+	adc_disable_autooff(ADC1);
+	adc_set_regular_sequence(ADC1, 1, (uint8_t *) &m_adc_channels[m_capture_channel]);
+	adc_enable_external_trigger_regular(ADC1, ADC_CFGR1_EXTSEL_TIM3_TRGO, ADC_CFGR1_EXTEN_RISING_EDGE);
+	
+	if (m_capture_trigger == CAPTURE_NOW) {
+		adc_disable_analog_watchdog(ADC1);
+		adc_disable_watchdog_interrupt(ADC1);
+		startCaptureDma(0);
+	} else {
+		// Converting without DMA until the watchdog sees the crossing, the channel is the only one in the sequence
+		int raw = std::clamp(toRaw(m_capture_threshold, m_vref, getCaptureRdiv()), 0, 4095);
+		adc_disable_dma(ADC1);
+		adc_enable_analog_watchdog_on_all_channels(ADC1);
+		adc_set_watchdog_low_threshold(ADC1, m_capture_trigger == CAPTURE_BELOW ? raw : 0);
+		adc_set_watchdog_high_threshold(ADC1, m_capture_trigger == CAPTURE_BELOW ? 4095 : raw);
+		adc_clear_watchdog_flag(ADC1);
+		adc_enable_watchdog_interrupt(ADC1);
+	}
+	
+	adc_power_on(ADC1);
+	adc_start_conversion_regular(ADC1);
+	
+	timer_set_period(TIM3, TIM3_CLOCK / Config::ADC_CAPTURE_RATE - 1);
+	timer_set_counter(TIM3, 0);
+	timer_enable_counter(TIM3);
+}
+
+// Called from the ADC ISR on a trigger, CFGR1 is writable only with the conversion stopped
+void AnalogMon::startCaptureDma(uint32_t offset) {
+	bool running = (ADC_CR(ADC1) & ADC_CR_ADSTART);
+	if (running) {
+		ADC_CR(ADC1) |= ADC_CR_ADSTP;
+		while ((ADC_CR(ADC1) & ADC_CR_ADSTART));
+		
+		// Next conversion was done before the stop, it is the next sample
+		if (adc_eoc(ADC1))
+			m_capture_buffer[offset++] = adc_read_regular(ADC1);
+	}
+	
+	dma_set_memory_address(DMA1, DMA_CHANNEL1, reinterpret_cast<uintptr_t>(&m_capture_buffer[offset]));
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1, Config::ADC_CAPTURE_SIZE - offset);
+	dma_enable_channel(DMA1, DMA_CHANNEL1);
+	adc_enable_dma(ADC1);
+	m_capture_state = CAPTURE_RUNNING;
+	
+	// TIM3 keeps running, the next trigger converts the next sample
+	if (running)
+		adc_start_conversion_regular(ADC1);
+}
+
+void AnalogMon::disarmCapture() {
+	if (!m_capture_armed)
+		return;
+	
+	timer_disable_counter(TIM3);
+	adc_disable_watchdog_interrupt(ADC1);
+	adc_power_off(ADC1);
+	dma_disable_channel(DMA1, DMA_CHANNEL1);
+	adc_disable_dma(ADC1);
+	
+	m_capture_armed = false;
+	Loop::unlockStop();
+}
+
+// ADC is free again: deferred read or the watch
+void AnalogMon::releaseCapture() {
+	disarmCapture();
+	switchFormAdcToExti(true);
+	
+	if (m_read_deferred) {
+		m_read_deferred = false;
+		read();
+	} else if (m_watch) {
+		armWatch();
+	}
+}
+
+void AnalogMon::onCaptureDone(void *, uint32_t) {
+	// Stopped meanwhile
+	if (m_capture_state != CAPTURE_RUNNING)
+		return;
+	
+	int rdiv = getCaptureRdiv();
+	for (auto &sample: m_capture_buffer)
+		sample = toVoltage(sample, m_vref, rdiv);
+	
+	m_capture_state = CAPTURE_DONE;
+	releaseCapture();
+	
+	if (m_capture_callback)
+		m_capture_callback(m_capture_user_data);
 }
 
 void AnalogMon::switchFormAdcToExti(bool to_exti) {
@@ -69,46 +339,97 @@ void AnalogMon::switchFormAdcToExti(bool to_exti) {
 	}
 }
 
-void AnalogMon::read() {
+bool AnalogMon::read() {
+	if (m_busy)
+		return false;
+	
+	// Running capture owns the ADC until its buffer is full
+	if (m_capture_state == CAPTURE_RUNNING) {
+		m_read_deferred = true;
+		return true;
+	}
+	
+	m_busy = true;
+	m_dma_work_done = false;
+	m_pwr_key_pressed = gpio_get(Pinout::PWR_KEY.port, Pinout::PWR_KEY.pin) != 0;
+	
+	// ADC and DMA are not clocked in STOP
+	Loop::lockStop();
+	
+	// Armed capture is re-armed when done
+	disarmWatch();
+	disarmCapture();
 	switchFormAdcToExti(false);
 	
+	setupRead();
 	adc_power_on(ADC1);
+	dma_set_number_of_data(DMA1, DMA_CHANNEL1, Config::ADC_AVG_CNT * COUNT_OF(m_adc_channels));
 	dma_enable_channel(DMA1, DMA_CHANNEL1);
+	adc_start_conversion_regular(ADC1);
 	
-	uint32_t result[COUNT_OF(m_adc_result)] = {};
-	
-	bool pwr_key_pressed = false;
-	for (int i = 0; i < ADC_AVG_CNT; i++) {
-		m_dma_work_done = false;
-		adc_start_conversion_regular(ADC1);
-		while (!m_dma_work_done) {
-			__asm__ volatile("wfi");
-		}
-		
-		for (size_t j = 0; j < COUNT_OF(m_adc_result); j++) {
-			result[j] += m_adc_result[j];
-			if (i == ADC_AVG_CNT - 1)
-				result[j] = result[j] / ADC_AVG_CNT;
-		}
-		
-		if (gpio_get(Pinout::PWR_KEY.port, Pinout::PWR_KEY.pin))
-			pwr_key_pressed = true;
-	}
+	return true;
+}
+
+void AnalogMon::wait() {
+	while (!m_dma_work_done)
+		WAIT_FOR_INTERRUPT();
+	onDone(nullptr, 0);
+}
+
+void AnalogMon::onDone(void *, uint32_t) {
+	// Already handled by wait()
+	if (!m_busy || !m_dma_work_done)
+		return;
 	
 	dma_disable_channel(DMA1, DMA_CHANNEL1);
 	adc_power_off(ADC1);
 	
 	switchFormAdcToExti(true);
 	
-	int vrefint = 3300 * VREFINT_CAL / result[VREF];
-	m_vbat = toVoltage(result[VBAT], vrefint, Config::VBAT_RDIV);
+	Loop::unlockStop();
+	
+	if (gpio_get(Pinout::PWR_KEY.port, Pinout::PWR_KEY.pin))
+		m_pwr_key_pressed = true;
+	
+	process();
+	m_sample_time = Loop::ms();
+	m_busy = false;
+	
+	if (m_capture_state == CAPTURE_ARMED) {
+		armCapture();
+	} else if (m_watch) {
+		armWatch();
+	}
+	
+	if (m_callback)
+		m_callback(m_user_data);
+}
+
+void AnalogMon::process() {
+	uint32_t result[COUNT_OF(m_adc_channels)] = {};
+	
+	for (size_t i = 0; i < Config::ADC_AVG_CNT; i++) {
+		for (size_t j = 0; j < COUNT_OF(m_adc_channels); j++)
+			result[j] += m_adc_buffer[i][j];
+	}
+	
+	// Rounded, so a power of two depth is a shift
+	for (size_t j = 0; j < COUNT_OF(m_adc_channels); j++)
+		result[j] = (result[j] + Config::ADC_AVG_CNT / 2) / Config::ADC_AVG_CNT;
+	
+	m_vref = 3300 * VREFINT_CAL / result[VREF];
+	m_vbat = toVoltage(result[VBAT], m_vref, Config::VBAT_RDIV);
 	m_cpu_temp = toTemperature(result[CPU_TEMP], Config::CPU_TEMP);
-	m_bat_temp_raw = toVoltage(result[BAT_TEMP], vrefint, 1000);
+	m_bat_temp_raw = toVoltage(result[BAT_TEMP], m_vref, 1000);
 	m_bat_temp = toTemperature(m_bat_temp_raw, Config::BAT_TEMP);
 	
-	if (!pwr_key_pressed) {
-		if (!m_ignore_dcin && Loop::ms() >= m_last_dcin_ignore) {
-			m_dcin = toVoltage(result[DCIN], vrefint, Config::DCIN_RDIV);
+	if (!m_pwr_key_pressed) {
+		// Forget the passed deadline, it would look like a future one after the ms timer wraps
+		if (m_dcin_ignore_window && Loop::timeReached(m_last_dcin_ignore))
+			m_dcin_ignore_window = false;
+		
+		if (!m_ignore_dcin && !m_dcin_ignore_window) {
+			m_dcin = toVoltage(result[DCIN], m_vref, Config::DCIN_RDIV);
 			m_dcin_present = gpio_get(Pinout::DCIN_ADC.port, Pinout::DCIN_ADC.pin) != 0;
 		}
 	}
@@ -118,6 +439,10 @@ int AnalogMon::toVoltage(int raw_value, int vref, int rdiv) {
 	return raw_value * vref / 4095 * rdiv / 1000;
 }
 
+int AnalogMon::toRaw(int voltage, int vref, int rdiv) {
+	return voltage * 1000 / rdiv * 4095 / vref;
+}
+
 int AnalogMon::toTemperature(int raw_value, const Config::Temp &calibration) {
 	return calibration.T[0] - (calibration.value[0] - raw_value) * (calibration.T[1] - calibration.T[0]) / (calibration.value[1] - calibration.value[0]);
 }
@@ -128,10 +453,51 @@ int AnalogMon::getBatPct() {
 
 void AnalogMon::dmaIrqHandler() {
 	dma_clear_interrupt_flags(DMA1, DMA_CHANNEL1, DMA_TCIF);
+	
+	if (m_capture_state == CAPTURE_RUNNING) {
+		m_capture_event.post();
+		return;
+	}
+	
 	m_dma_work_done = true;
+	m_done_event.post();
+}
+
+void AnalogMon::adcIrqHandler() {
+	if (adc_get_watchdog_flag(ADC1)) {
+		adc_clear_watchdog_flag(ADC1);
+		
+		// One-shot until the next read, the value stays out of the window meanwhile
+		adc_disable_watchdog_interrupt(ADC1);
+		adc_disable_eoc_interrupt(ADC1);
+		
+		// Capture trigger, the crossing conversion is the first sample
+		if (m_capture_state == CAPTURE_ARMED) {
+			m_capture_buffer[0] = adc_read_regular(ADC1);
+			startCaptureDma(1);
+			return;
+		}
+		
+		m_watch_event.post();
+		return;
+	}
+	
+	// Watched channel is within its threshold, the next trigger converts the other one
+	if (adc_eoc(ADC1)) {
+		adc_read_regular(ADC1);
+		if (m_watch_armed && m_watch_channels_cnt > 1) {
+			m_watch_channel_idx = m_watch_channel_idx ^ 1;
+			selectWatchChannel(m_watch_channel_idx);
+		}
+	}
 }
 
 void dma1_channel1_isr() {
 	if (m_instance)
 		m_instance->dmaIrqHandler();
 }
+
+void adc_comp_isr() {
+	if (m_instance)
+		m_instance->adcIrqHandler();
+}
@@ -12,12 +12,10 @@
 #include "Debug.h"
 #include "utils.h"
 
-#define VREFINT_CAL (*((uint16_t *) 0x1FFFF7BA))
-#define TS_CAL1 (*((uint16_t *) 0x1FFFF7B8))
-#define TS_CAL2 (*((uint16_t *) 0x1FFFF7C2))
-
 class AnalogMon {
 	public:
+		typedef delegate<void(void *)> Callback;
+		
 		enum Value : int {
 			DCIN = 0,
 			VBAT,
@@ -25,9 +23,24 @@ class AnalogMon {
 			CPU_TEMP,
 			VREF
 		};
+		
+		enum CaptureTrigger : int {
+			CAPTURE_NOW = 0,
+			CAPTURE_BELOW,
+			CAPTURE_ABOVE
+		};
+		
+		enum CaptureState : int {
+			CAPTURE_IDLE = 0,
+			CAPTURE_ARMED,
+			CAPTURE_RUNNING,
+			CAPTURE_DONE
+		};
 	
 	protected:
-		constexpr static int ADC_AVG_CNT = 10;
+		// TIM3 counter clock, shared by the watch and the capture
+		static constexpr uint32_t TIM3_CLOCK = 100000;
+		
 		constexpr static uint8_t m_adc_channels[] = {
 			Pinout::ADC_CH_DCIN,
 			Pinout::ADC_CH_VBAT,
@@ -35,28 +48,135 @@ class AnalogMon {
 			ADC_CHANNEL_TEMP,
 			ADC_CHANNEL_VREF,
 		};
-		uint16_t m_adc_result[COUNT_OF(m_adc_channels)] = {};
-		bool m_ignore_dcin = false;
-		int64_t m_last_dcin_ignore = 0;
-		
-		bool m_dma_work_done = false;
+		static_assert(Config::ADC_AVG_CNT > 0 && Config::ADC_AVG_CNT * COUNT_OF(m_adc_channels) <= 0xFFFF, "Invalid ADC_AVG_CNT");
 		
+		// All scans of one read, filled by a single DMA transfer
+		uint16_t m_adc_buffer[Config::ADC_AVG_CNT][COUNT_OF(m_adc_channels)] = {};
+		bool m_ignore_dcin = false;
+		bool m_dcin_ignore_window = false;	// m_last_dcin_ignore is not reached yet
+		uint32_t m_last_dcin_ignore = 0;
+		
+		Callback m_callback;
+		void *m_user_data = nullptr;
+		Event m_done_event;
+		volatile bool m_dma_work_done = false;
+		bool m_busy = false;
+		bool m_pwr_key_pressed = false;
+		
+		Callback m_watch_callback;
+		void *m_watch_user_data = nullptr;
+		Event m_watch_event;
+		bool m_watch = false;
+		bool m_watch_armed = false;
+		
+		// Single-channel watchdog, the channels take turns on each TIM3 trigger
+		struct WatchChannel {
+			uint8_t channel;
+			uint16_t threshold;
+		};
+		WatchChannel m_watch_channels[2] = {};
+		uint8_t m_watch_channels_cnt = 0;
+		volatile uint8_t m_watch_channel_idx = 0;
+		
+		// Raw samples while running, mV when done
+		uint16_t m_capture_buffer[Config::ADC_CAPTURE_SIZE] = {};
+		Callback m_capture_callback;
+		void *m_capture_user_data = nullptr;
+		Event m_capture_event;
+		volatile CaptureState m_capture_state = CAPTURE_IDLE;
+		CaptureTrigger m_capture_trigger = CAPTURE_NOW;
+		Value m_capture_channel = VBAT;
+		int m_capture_threshold = 0;
+		bool m_capture_armed = false;
+		bool m_read_deferred = false;
+		
+		int m_vref = 3300;
 		int m_vbat = 0;
 		int m_dcin = 0;
 		int m_cpu_temp = 0;
 		int m_bat_temp = 0;
 		int m_bat_temp_raw = 0;
 		bool m_dcin_present = false;
+		uint32_t m_sample_time = 0;
+		
+		void onDone(void *, uint32_t);
+		void onWatchAlert(void *, uint32_t);
+		void process();
+		void setupRead();
+		void armWatch();
+		void disarmWatch();
+		void selectWatchChannel(uint8_t index);
+		void onCaptureDone(void *, uint32_t);
+		void armCapture();
+		void disarmCapture();
+		void releaseCapture();
+		void startCaptureDma(uint32_t offset);
+		int getCaptureRdiv();
+		int getWatchThreshold(int voltage, int rdiv);
 	public:
 		AnalogMon();
 		~AnalogMon();
 		
 		void init();
 		
-		void read();
+		inline void setCallback(Callback callback, void *user_data = nullptr) {
+			m_callback = callback;
+			m_user_data = user_data;
+		}
+		
+		// Start the scan, the callback is called from the loop when new values are ready
+		bool read();
+		
+		// Blocking wait for the scan, for use outside of the loop
+		void wait();
+		
+		inline bool isBusy() {
+			return m_busy;
+		}
+		
+		/*
+		 * Analog watchdog between reads: VBAT and DCIN are converted every Config::ADC_WATCH_INTERVAL ms
+		 * and the watch callback is called from the loop when one of them falls below its own threshold.
+		 * Re-armed with fresh thresholds after each read. STOP is locked while armed.
+		 * */
+		void setWatch(bool enable);
+		
+		inline void setWatchCallback(Callback callback, void *user_data = nullptr) {
+			m_watch_callback = callback;
+			m_watch_user_data = user_data;
+		}
+		
+		inline bool isWatching() {
+			return m_watch_armed;
+		}
+		
+		/*
+		 * Waveform capture: Config::ADC_CAPTURE_SIZE samples of DCIN or VBAT at Config::ADC_CAPTURE_RATE.
+		 * Starts right away or on the first sample crossing the threshold (mV), the callback is called
+		 * from the loop when the buffer is full. Keeps the ADC and STOP locked while armed,
+		 * reads wait for a running capture and suspend an armed one.
+		 * */
+		bool startCapture(Value channel, CaptureTrigger trigger, int threshold);
+		void stopCapture();
+		
+		inline void setCaptureCallback(Callback callback, void *user_data = nullptr) {
+			m_capture_callback = callback;
+			m_capture_user_data = user_data;
+		}
+		
+		inline CaptureState getCaptureState() {
+			return m_capture_state;
+		}
+		
+		// Samples in mV, only valid when done
+		inline const uint16_t *getCapture() {
+			return m_capture_buffer;
+		}
+		
 		void switchFormAdcToExti(bool to_exti);
 		
 		int toVoltage(int raw_value, int vref, int rdiv);
+		int toRaw(int voltage, int vref, int rdiv);
 		int toTemperature(int raw_value, const Config::Temp &calibration);
 		
 		inline int isBatDischarged() {
@@ -87,8 +207,14 @@ class AnalogMon {
 			return m_cpu_temp;
 		}
 		
+		// Loop::ms() of the last completed scan
+		inline uint32_t getSampleTime() {
+			return m_sample_time;
+		}
+		
 		inline void ignoreDcinVoltage(bool state) {
 			m_ignore_dcin = state;
+			m_dcin_ignore_window = true;
 			m_last_dcin_ignore = Loop::ms() + 1000;
 		}
 		
@@ -103,4 +229,5 @@ class AnalogMon {
 		}
 		
 		void dmaIrqHandler();
+		void adcIrqHandler();
 };
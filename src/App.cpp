@@ -2,6 +2,8 @@
 
 #include <algorithm>
 #include <climits>
+#include <cstddef>
+#include <cstring>
 
 #include "Loop.h"
 #include "Task.h"
@@ -30,12 +32,45 @@ bool App::setStateBit(uint32_t bit, bool value) {
 		m_state &= ~bit;
 	}
 	
-	if (is_changed) {
+	if (is_changed)
+		raiseIrq(bit);
+	
+	return is_changed;
+}
+
+void App::raiseIrq(uint32_t bit) {
+	m_irq_changed |= bit;
+	m_publish.post();
+	
+	if ((bit & m_irq_mask)) {
+		m_irq_seq++;
 		gpio_set(Pinout::I2C_IRQ.port, Pinout::I2C_IRQ.pin);
 		m_task_irq_pulse.setTimeout(10);
 	}
-	
-	return is_changed;
+}
+
+int App::getDeadbandValue(Deadband id) {
+	switch (id) {
+		case DEADBAND_VBAT:			return m_mon.getVbat();
+		case DEADBAND_DCIN:			return m_mon.getDcin();
+		case DEADBAND_BAT_TEMP:		return m_mon.getBatTemp();
+		case DEADBAND_BAT_PCT:		return getBatPct();
+		case DEADBAND_COUNT:		break;
+	}
+	return 0;
+}
+
+void App::checkDeadbands() {
+	for (int i = 0; i < DEADBAND_COUNT; i++) {
+		if (!m_deadband[i])
+			continue;
+		
+		int value = getDeadbandValue(static_cast<Deadband>(i));
+		if (abs(value - m_deadband_ref[i]) > m_deadband[i]) {
+			m_deadband_ref[i] = value;
+			raiseIrq(VBAT_MOVED << i);
+		}
+	}
 }
 
 void App::initHw() {
@@ -132,12 +167,76 @@ void App::watchdogTask(void *) {
 	m_task_watchdog.setTimeout(Config::WATCHDOG_TIMEOUT / 2);
 }
 
+void App::alarmTask(void *) {
+	if (!m_alarm_time)
+		return;
+	
+	// Long alarms are scheduled in steps, the RTC could also be set meanwhile
+	if (RTC::time() < m_alarm_time) {
+		scheduleAlarm();
+		return;
+	}
+	
+	LOGD("RTC alarm\r\n");
+	setAlarm(0);
+	setStateBit(RTC_ALARM, true);
+	
+	// Same as the key release, the next scan powers on with valid values after the wakeup
+	if (is(USER_POWER_OFF)) {
+		m_last_pwron_fail = PWR_FAIL_NONE;
+		setStateBit(USER_POWER_OFF, false);
+		m_task_analog_mon.setTimeout(0);
+	}
+}
+
+void App::setAlarm(uint32_t time) {
+	m_alarm_time = time;
+	
+	pwr_disable_backup_domain_write_protect();
+	RTC_BKPXR(2) = time;
+	pwr_enable_backup_domain_write_protect();
+	
+	scheduleAlarm();
+}
+
+// In deep sleep the RTC alarm takes over
+void App::scheduleAlarm() {
+	if (!m_alarm_time || is(ALLOW_DEEP_SLEEP)) {
+		m_task_alarm.cancel();
+		return;
+	}
+	
+	uint32_t now = RTC::time();
+	uint32_t seconds = m_alarm_time > now ? std::min(m_alarm_time - now, Config::STOP_MAX_IDLE_TIME / 1000) : 0;
+	m_task_alarm.setTimeout(seconds * 1000);
+}
+
 void App::irqPulseTask(void *) {
 	gpio_clear(Pinout::I2C_IRQ.port, Pinout::I2C_IRQ.pin);
 }
 
+void App::onIrqAck(void *, uint32_t irq_seq) {
+	// Keep the pulse, if an IRQ was raised after the file the host read was published
+	if (irq_seq == m_irq_seq)
+		m_task_irq_pulse.cancel();
+}
+
+void App::analogScanTask(void *) {
+	// Busy means the running scan is not done yet, its result is handled the same way
+	if (m_mon.read() && m_measure_req) {
+		m_measure_req = false;
+		m_measure_scan = true;
+	}
+}
+
 void App::monitorTask(void *) {
-	m_mon.read();
+	// Published after the whole pass
+	m_publish.post();
+	
+	if (m_measure_scan) {
+		m_measure_scan = false;
+		setStateBit(MEASURE_READY, true);
+	}
 	
 	if (setStateBit(DCIN_PRESENT, m_mon.isDcinPresent())) {
 		LOGD("DCIN %s!\r\n", is(DCIN_PRESENT) ? "connected" : "disconnected");
@@ -199,6 +298,14 @@ void App::monitorTask(void *) {
 	if (setStateBit(BAT_CHARGING, m_charger_status.isPressed() && is(BAT_CHARGE_EN)))
 		LOGD("Battery %s\r\n", is(BAT_CHARGING) ? "is charging..." : "is stop charging!");
 	
+	checkDeadbands();
+	
+	m_history.add(m_state & STATE_LEVELS, {m_mon.getVbat(), m_mon.getDcin(), m_mon.getBatTemp(), m_mon.getCpuTemp()});
+	
+	// Not while the host may be streaming the ring
+	if (m_history.isDue() && !I2CSlave::isBusy())
+		m_history.push(RTC::time());
+	
 	if (!is(POWER_ON) && !is(USER_POWER_OFF) && !isAutoPowerOnDisabled())
 		powerOn();
 	
@@ -220,15 +327,21 @@ void App::monitorTask(void *) {
 			idec(m_mon.getCpuTemp()), iexp(m_mon.getCpuTemp())
 		);
 		m_last_info_print = Loop::ms();
+		
+		#if DEBUG_SCHED_STATS
+		dumpSchedStats();
+		#endif
 	}
 	
+	updateStopMode();
+	
 	uint32_t next_timeout = 30000;
 	if (is(BAT_CHARGING)) {
 		next_timeout = 200;
 	} else if (is(BAT_CHARGE_EN)) {
 		next_timeout = 500;
 	} else if (is(DCIN_GOOD)) {
-		next_timeout = 1000;
+		next_timeout = m_mon.isWatching() ? Config::ADC_WATCH_IDLE_POLL : 1000;
 	} else if (is(DCIN_PRESENT) && Loop::ms() - m_dcin_connected <= 5000) {
 		next_timeout = 1000;
 	} else if (!is(POWER_ON) && !is(DCIN_PRESENT)) {
@@ -244,10 +357,23 @@ void App::monitorTask(void *) {
 	
 	allowDeepSleep(false);
 	
+	// Requested while this scan was running, the next one is for the host
+	if (m_measure_req)
+		next_timeout = 0;
+	
 	iwdg_reset();
+	m_task_analog_mon.setSlack(next_timeout / Config::TASK_SLACK_DIV);
 	m_task_analog_mon.setTimeout(next_timeout);
 }
 
+void App::updateStopMode() {
+	// Buzzer PWM is not clocked in STOP, I2C slave wakes up on the address match
+	Loop::allowStop(!Buzzer::isPlaying());
+	
+	// Fast undervoltage reaction only matters for the powered system, opt-in since it costs STOP
+	m_mon.setWatch(m_adc_watch && is(POWER_ON));
+}
+
 void App::allowDeepSleep(bool flag) {
 	if (setStateBit(ALLOW_DEEP_SLEEP, flag)) {
 		if (flag) {
@@ -257,6 +383,7 @@ void App::allowDeepSleep(bool flag) {
 			m_task_analog_mon.setTimeout(0);
 			m_task_watchdog.setTimeout(0);
 		}
+		scheduleAlarm();
 	}
 }
 
@@ -282,6 +409,45 @@ const char *App::getEnumName(PwrOnFailureReason reason) {
 	return "???";
 }
 
+const char *App::getEnumName(TaskId id) {
+	switch (id) {
+		case TASK_ANALOG_MON:	return "ANALOG_MON";
+		case TASK_WATCHDOG:		return "WATCHDOG";
+		case TASK_IRQ_PULSE:	return "IRQ_PULSE";
+		case TASK_ALARM:		return "ALARM";
+		case TASK_COUNT:		break;
+	}
+	return "???";
+}
+
+Task *App::getTask(uint32_t id) {
+	switch (id) {
+		case TASK_ANALOG_MON:	return &m_task_analog_mon;
+		case TASK_WATCHDOG:		return &m_task_watchdog;
+		case TASK_IRQ_PULSE:	return &m_task_irq_pulse;
+		case TASK_ALARM:		return &m_task_alarm;
+	}
+	return nullptr;
+}
+
+void App::dumpSchedStats() {
+	auto &loop = Loop::stats();
+	LOGD(
+		"Loop: iterations=%lu, wfi=%lu, idle=%lu, stop=%lu, events=%lu, coalesced=%lu\r\n",
+		(unsigned long) loop.iterations, (unsigned long) loop.wfi, (unsigned long) loop.idle, (unsigned long) loop.stop,
+		(unsigned long) loop.events, (unsigned long) loop.coalesced
+	);
+	
+	for (int id = 0; id < TASK_COUNT; id++) {
+		auto &stats = getTask(id)->stats();
+		LOGD(
+			"Task %s: runs=%lu, time=%lu us, max=%lu us, late=%lu ms\r\n",
+			getEnumName(static_cast<TaskId>(id)), (unsigned long) stats.runs, (unsigned long) stats.total_time,
+			(unsigned long) stats.max_time, (unsigned long) stats.max_lateness
+		);
+	}
+}
+
 uint32_t App::getTimeoutForChrgFail() {
 	switch (m_last_chrg_failure) {
 		case CHRG_FAIL_LOW_TEMP:	return Config::CHARGING_BAD_TEMP_TIMEOUT;
@@ -295,9 +461,13 @@ uint32_t App::getTimeoutForChrgFail() {
 }
 
 bool App::isChargingDisabled() {
+	// Forget the failure after its timeout, the elapsed time becomes ambiguous when the ms timer wraps
+	if (m_last_chrg_failure_time && Loop::ms() - m_last_chrg_failure_time >= getTimeoutForChrgFail())
+		m_last_chrg_failure_time = 0;
+	
 	if (!is(DCIN_GOOD))
 		return true;
-	return m_last_chrg_failure_time && (Loop::ms() - m_last_chrg_failure_time < getTimeoutForChrgFail());
+	return m_last_chrg_failure_time != 0;
 }
 
 bool App::isAutoPowerOnDisabled() {
@@ -372,6 +542,15 @@ void App::onBatChange(void *, bool) {
 	m_task_analog_mon.setTimeout(0);
 }
 
+void App::onAnalogWatch(void *) {
+	LOGD("ADC watchdog: voltage drop\r\n");
+	m_task_analog_mon.setTimeout(0);
+}
+
+void App::onCaptureDone(void *) {
+	setStateBit(CAPTURE_READY, true);
+}
+
 void App::onChargerStatus(void *, Button::Event) {
 	m_task_analog_mon.setTimeout(0);
 }
@@ -397,6 +576,25 @@ void App::onPwrKey(void *, Button::Event evt) {
 }
 
 bool App::idleHook(void *) {
+	if (m_alarm_time) {
+		// Too close to catch the alarm after the reset, it is waited for in the loop
+		uint32_t now = RTC::time();
+		if (now + 1 >= m_alarm_time) {
+			if (now >= m_alarm_time) {
+				alarmTask(nullptr);
+			} else {
+				// Rest of the current second, alarmTask checks again then
+				uint32_t phase = RTC::ticks() % RTC::TICKS_PER_SECOND;
+				m_task_alarm.setTimeout((RTC::TICKS_PER_SECOND - phase) * 1000 / RTC::TICKS_PER_SECOND + 1);
+			}
+			return true;
+		}
+		
+		RTC::tm alarm;
+		RTC::fromUnixTime(m_alarm_time, &alarm);
+		RTC::setAlarm(alarm.hours, alarm.minutes, alarm.seconds, alarm.day);
+	}
+	
 	LOGD("No tasks, going to deep sleep...\r\n\r\n\r\n");
 	
 	pwr_disable_backup_domain_write_protect();
@@ -408,28 +606,136 @@ bool App::idleHook(void *) {
 }
 
 uint32_t App::readReg(void *, uint8_t reg) {
-	if (reg == I2C_REG_IRQ_STATUS) {
+	const Shadow &shadow = m_shadow[m_shadow_idx];
+	
+	if (reg == I2C_REG_IRQ_STATUS || reg == I2C_REG_IRQ_CHANGED) {
 		gpio_set(Pinout::I2C_IRQ.port, Pinout::I2C_IRQ.pin);
-		m_task_irq_pulse.cancel();
+		m_irq_ack.post(shadow.irq_seq);
+	}
+	
+	// ISR is not preempted by the loop, so this read and clear is atomic
+	if (reg == I2C_REG_IRQ_CHANGED) {
+		uint32_t changed = m_irq_latched;
+		m_irq_latched = 0;
+		return changed;
 	}
 	
 	switch (reg) {
-		case I2C_REG_STATUS:				return m_state;
-		case I2C_REG_IRQ_STATUS:			return m_state;
-		case I2C_REG_BAT_VOLTAGE:			return m_mon.getVbat();
-		case I2C_REG_BAT_TEMP:				return m_mon.getBatTemp();
+		case I2C_REG_STATUS:				return shadow.snapshot.status;
+		case I2C_REG_IRQ_STATUS:			return shadow.snapshot.status;
+		case I2C_REG_BAT_VOLTAGE:			return shadow.snapshot.bat_voltage;
+		case I2C_REG_BAT_TEMP:				return shadow.snapshot.bat_temp;
 		case I2C_REG_BAT_MIN_TEMP:			return Config::BAT.t_min;
 		case I2C_REG_BAT_MAX_TEMP:			return Config::BAT.t_max;
-		case I2C_REG_BAT_PCT:				return (m_state & BAT_CHARGING) ? std::min(99 * 1000, m_mon.getBatPct()) : m_mon.getBatPct();
-		case I2C_REG_DCIN_VOLTAGE:			return m_mon.getDcin();
-		case I2C_REG_CPU_TEMP:				return m_mon.getCpuTemp();
+		case I2C_REG_BAT_PCT:				return shadow.snapshot.bat_pct;
+		case I2C_REG_DCIN_VOLTAGE:			return shadow.snapshot.dcin_voltage;
+		case I2C_REG_CPU_TEMP:				return shadow.snapshot.cpu_temp;
 		case I2C_REG_GET_MIN_BAT_VOLTAGE:	return Config::BAT.v_min;
 		case I2C_REG_GET_MAX_BAT_VOLTAGE:	return Config::BAT.v_max;
-		case I2C_REG_RTC_TIME:				return RTC::time();
+		case I2C_REG_RTC_TIME:				return getShadowRtcTime(shadow);
+		case I2C_REG_SHADOW_SEQ:			return shadow.snapshot.seq;
+		case I2C_REG_SAMPLE_AGE:			return Loop::ms() - shadow.sample_ms;
+		case I2C_REG_DEADBAND_VBAT:
+		case I2C_REG_DEADBAND_DCIN:
+		case I2C_REG_DEADBAND_BAT_TEMP:
+		case I2C_REG_DEADBAND_BAT_PCT:		return m_deadband[reg - I2C_REG_DEADBAND_VBAT];
+		case I2C_REG_HISTORY_CURSOR:		return m_history.getCursor();
+		case I2C_REG_CAPTURE:				return m_mon.getCaptureState() | Config::ADC_CAPTURE_SIZE << 16;
+		case I2C_REG_RTC_ALARM:				return m_alarm_time;
+		case I2C_REG_ADC_WATCH:				return m_adc_watch;
+		case I2C_REG_IRQ_MASK:				return m_irq_mask;
+		case I2C_REG_LOOP_ITERATIONS:		return Loop::stats().iterations;
+		case I2C_REG_LOOP_WFI:				return Loop::stats().wfi;
+		case I2C_REG_LOOP_IDLE:				return Loop::stats().idle;
+		case I2C_REG_LOOP_STOP:				return Loop::stats().stop;
+		case I2C_REG_LOOP_EVENTS:			return Loop::stats().events;
+		case I2C_REG_LOOP_COALESCED:		return Loop::stats().coalesced;
+		case I2C_REG_TASK_SELECT:			return m_selected_task;
+	}
+	
+	Task *task = getTask(m_selected_task);
+	switch (reg) {
+		case I2C_REG_TASK_RUNS:				return task->stats().runs;
+		case I2C_REG_TASK_TIME:				return task->stats().total_time;
+		case I2C_REG_TASK_MAX_TIME:			return task->stats().max_time;
+		case I2C_REG_TASK_MAX_LATENESS:		return task->stats().max_lateness;
 	}
 	return 0xFFFFFFFF;
 }
 
+uint32_t App::readBlock(void *, uint8_t reg, uint8_t *buffer, uint32_t size) {
+	if (reg != I2C_REG_SNAPSHOT || size < sizeof(Snapshot))
+		return 0;
+	
+	const Shadow &shadow = m_shadow[m_shadow_idx];
+	memcpy(buffer, &shadow.snapshot, sizeof(shadow.snapshot));
+	
+	uint32_t rtc_time = getShadowRtcTime(shadow);
+	memcpy(buffer + offsetof(Snapshot, rtc_time), &rtc_time, sizeof(rtc_time));
+	
+	uint32_t sample_age = Loop::ms() - shadow.sample_ms;
+	memcpy(buffer + offsetof(Snapshot, sample_age), &sample_age, sizeof(sample_age));
+	
+	return sizeof(Snapshot);
+}
+
+uint32_t App::readStream(void *, uint8_t reg, const uint8_t **data) {
+	switch (reg) {
+		case I2C_REG_HISTORY:
+			return m_history.getUnread(data);
+		
+		case I2C_REG_CAPTURE_DATA:
+			// Buffer is being written until done
+			if (m_mon.getCaptureState() != AnalogMon::CAPTURE_DONE)
+				return 0;
+			*data = reinterpret_cast<const uint8_t *>(m_mon.getCapture());
+			return Config::ADC_CAPTURE_SIZE * sizeof(uint16_t);
+	}
+	return 0;
+}
+
+void App::publishShadow(void *, uint32_t) {
+	Shadow &shadow = m_shadow[m_shadow_idx ^ 1];
+	
+	shadow.snapshot.version = SNAPSHOT_VERSION;
+	shadow.snapshot.size = sizeof(Snapshot);
+	shadow.snapshot.seq = ++m_shadow_seq;
+	shadow.snapshot.status = m_state;
+	shadow.snapshot.bat_voltage = m_mon.getVbat();
+	shadow.snapshot.bat_temp = m_mon.getBatTemp();
+	shadow.snapshot.bat_pct = getBatPct();
+	shadow.snapshot.dcin_voltage = m_mon.getDcin();
+	shadow.snapshot.cpu_temp = m_mon.getCpuTemp();
+	shadow.sample_ms = m_mon.getSampleTime();
+	shadow.irq_seq = m_irq_seq;
+	
+	// Phase of the RTC second, the time is extrapolated with Loop::ms() until the next publish
+	uint32_t ticks;
+	do {
+		ticks = RTC::ticks();
+		shadow.snapshot.rtc_time = RTC::time();
+	} while (ticks / RTC::TICKS_PER_SECOND != RTC::ticks() / RTC::TICKS_PER_SECOND);
+	shadow.rtc_ms = Loop::ms() - ticks % RTC::TICKS_PER_SECOND * 1000 / RTC::TICKS_PER_SECOND;
+	
+	// Single byte store, the ISR sees either the old or the new file
+	m_shadow_idx = m_shadow_idx ^ 1;
+	
+	// Changes become visible together with the status they belong to, masked sources are dropped
+	ENTER_CRITICAL();
+	m_irq_latched = m_irq_latched | (m_irq_changed & m_irq_mask);
+	EXIT_CRITICAL();
+	m_irq_changed = 0;
+}
+
+uint32_t App::getShadowRtcTime(const Shadow &shadow) {
+	return shadow.snapshot.rtc_time + (Loop::ms() - shadow.rtc_ms) / 1000;
+}
+
+int App::getBatPct() {
+	// 100% only after the charging is done
+	return is(BAT_CHARGING) ? std::min(99 * 1000, m_mon.getBatPct()) : m_mon.getBatPct();
+}
+
 void App::writeReg(void *, uint8_t reg, uint32_t value) {
 	switch (reg) {
 		case I2C_REG_POWER_OFF:
@@ -452,6 +758,71 @@ void App::writeReg(void *, uint8_t reg, uint32_t value) {
 			RTC::tm new_tm;
 			RTC::fromUnixTime(value, &new_tm);
 			RTC::setDateTime(new_tm.year, new_tm.month, new_tm.day, new_tm.hours, new_tm.minutes, new_tm.seconds);
+			m_publish.post();
+			scheduleAlarm();
+		break;
+		
+		case I2C_REG_RTC_ALARM:
+			// Cleared silently, only the alarm raises I2C_IRQ, but the host sees it right away
+			m_state &= ~RTC_ALARM;
+			m_publish.post();
+			setAlarm(value);
+		break;
+		
+		case I2C_REG_MEASURE:
+			// Cleared silently, only the completion raises I2C_IRQ, but the host sees it right away
+			m_state &= ~MEASURE_READY;
+			m_publish.post();
+			m_measure_req = true;
+			m_task_analog_mon.setTimeout(0);
+		break;
+		
+		case I2C_REG_DEADBAND_VBAT:
+		case I2C_REG_DEADBAND_DCIN:
+		case I2C_REG_DEADBAND_BAT_TEMP:
+		case I2C_REG_DEADBAND_BAT_PCT:
+			// Measured from the value the host has now
+			m_deadband[reg - I2C_REG_DEADBAND_VBAT] = std::min(value, static_cast<uint32_t>(INT_MAX));
+			m_deadband_ref[reg - I2C_REG_DEADBAND_VBAT] = getDeadbandValue(static_cast<Deadband>(reg - I2C_REG_DEADBAND_VBAT));
+		break;
+		
+		case I2C_REG_HISTORY_CURSOR:
+			m_history.setCursor(value);
+		break;
+		
+		case I2C_REG_CAPTURE:
+			// Cleared silently, only the completion raises I2C_IRQ, but the host sees it right away
+			m_state &= ~CAPTURE_READY;
+			m_publish.post();
+			
+			if ((value & 0xFF) == 0) {
+				m_mon.stopCapture();
+			} else {
+				m_mon.startCapture(
+					static_cast<AnalogMon::Value>((value >> 8) & 0xFF),
+					static_cast<AnalogMon::CaptureTrigger>((value & 0xFF) - 1),
+					value >> 16
+				);
+			}
+		break;
+		
+		case I2C_REG_TASK_SELECT:
+			if (value < TASK_COUNT)
+				m_selected_task = value;
+		break;
+		
+		case I2C_REG_IRQ_MASK:
+			m_irq_mask = value;
+			
+			// Silenced sources are dropped from the unread changes too
+			ENTER_CRITICAL();
+			m_irq_latched = m_irq_latched & value;
+			EXIT_CRITICAL();
+		break;
+		
+		case I2C_REG_ADC_WATCH:
+			m_adc_watch = (value != 0);
+			updateStopMode();
 		break;
 		
 		case I2C_REG_PLAY_BUZZER:
@@ -463,6 +834,7 @@ void App::writeReg(void *, uint8_t reg, uint32_t value) {
 			} else {
 				Buzzer::stop();
 			}
+			updateStopMode();
 		break;
 	}
 }
@@ -506,37 +878,54 @@ int App::run() {
 	while (true) {
 		if (!last_time || Loop::ms() - last_time > 1000) {
 			m_mon.read();
+			m_mon.wait();
 			LOGD(
 				"BAT TEMP: %d mV / %d.%d °C\r\n",
 				m_mon.getBatTempRaw(), idec(m_mon.getBatTemp()), iexp(m_mon.getBatTemp())
 			);
 			last_time = Loop::ms();
 		}
-		__asm__ volatile("wfi");
+		WAIT_FOR_INTERRUPT();
 	}
 	#endif
 	
+	// Register file for the host, valid before the first I2C transfer
+	m_publish.init(Event::Callback::make<&App::publishShadow>(*this));
+	publishShadow(nullptr, 0);
+	
 	// I2C
 	I2CSlave::init();
 	I2CSlave::setCallback(
 		I2CSlave::ReadCallback::make<&App::readReg>(*this),
 		I2CSlave::WriteCallback::make<&App::writeReg>(*this)
 	);
+	I2CSlave::setReadBlockCallback(I2CSlave::ReadBlockCallback::make<&App::readBlock>(*this));
+	I2CSlave::setReadStreamCallback(I2CSlave::ReadStreamCallback::make<&App::readStream>(*this));
 	
 	// Idle hook
 	Loop::setIdleCallback(Loop::IdleCallback::make<&App::idleHook>(*this));
 	
 	// IRQ pulse
 	m_task_irq_pulse.init(Task::Callback::make<&App::irqPulseTask>(*this));
+	m_irq_ack.init(Event::Callback::make<&App::onIrqAck>(*this));
 	
-	// Analog monitor task
-	m_task_analog_mon.init(Task::Callback::make<&App::monitorTask>(*this));
+	// Analog monitor task, processes the scan results
+	m_mon.setCallback(AnalogMon::Callback::make<&App::monitorTask>(*this));
+	m_mon.setWatchCallback(AnalogMon::Callback::make<&App::onAnalogWatch>(*this));
+	m_mon.setCaptureCallback(AnalogMon::Callback::make<&App::onCaptureDone>(*this));
+	m_task_analog_mon.init(Task::Callback::make<&App::analogScanTask>(*this));
 	m_task_analog_mon.setTimeout(0);
 	
 	// Watchdog task
 	m_task_watchdog.init(Task::Callback::make<&App::watchdogTask>(*this));
+	m_task_watchdog.setSlack(Config::WATCHDOG_TIMEOUT / 2 / Config::TASK_SLACK_DIV);
 	m_task_watchdog.setTimeout(0);
 	
+	// RTC alarm, may be the reason of the wakeup from deep sleep
+	m_task_alarm.init(Task::Callback::make<&App::alarmTask>(*this));
+	m_alarm_time = RTC_BKPXR(2);
+	scheduleAlarm();
+	
 	// Power key
 	m_pwr_key.update(gpio_get(Pinout::PWR_KEY.port, Pinout::PWR_KEY.pin) != 0);
 	m_pwr_key.init(Button::Callback::make<&App::onPwrKey>(*this));
@@ -6,9 +6,11 @@
 #include <libopencm3/stm32/adc.h>
 #include "Pinout.h"
 #include "Task.h"
+#include "Event.h"
 #include "Button.h"
 #include "I2CSlave.h"
 #include "AnalogMon.h"
+#include "History.h"
 #include "utils.h"
 
 class App {
@@ -34,9 +36,28 @@ class App {
 			PWR_KEY_PRESSED			= 1 << 11,
 			
 			// Deep sleep
-			ALLOW_DEEP_SLEEP		= 1 << 12
+			ALLOW_DEEP_SLEEP		= 1 << 12,
+			
+			// Values of the on-demand measurement are published, cleared by the next request
+			MEASURE_READY			= 1 << 13,
+			
+			// Waveform capture is done, cleared by the next capture command
+			CAPTURE_READY			= 1 << 14,
+			
+			// RTC alarm fired, cleared by the next alarm write
+			RTC_ALARM				= 1 << 15,
+			
+			// Events, only seen in IRQ_CHANGED: value moved out of its deadband
+			VBAT_MOVED				= 1 << 16,
+			DCIN_MOVED				= 1 << 17,
+			BAT_TEMP_MOVED			= 1 << 18,
+			BAT_PCT_MOVED			= 1 << 19,
 		};
 		
+		// Bits below the events, the only ones kept in History::Record::state
+		static constexpr uint32_t STATE_LEVELS = VBAT_MOVED - 1;
+		static_assert(STATE_LEVELS < (1ULL << (8 * sizeof(History::Record::state))), "State bits don't fit History::Record::state");
+		
 		enum Regs {
 			// Read
 			I2C_REG_STATUS,
@@ -53,6 +74,93 @@ class App {
 			I2C_REG_POWER_OFF,
 			I2C_REG_RTC_TIME,
 			I2C_REG_PLAY_BUZZER,
+			
+			// Scheduler stats
+			I2C_REG_LOOP_ITERATIONS,
+			I2C_REG_LOOP_WFI,
+			I2C_REG_LOOP_IDLE,
+			I2C_REG_TASK_SELECT,
+			I2C_REG_TASK_RUNS,
+			I2C_REG_TASK_TIME,
+			I2C_REG_TASK_MAX_TIME,
+			I2C_REG_TASK_MAX_LATENESS,
+			I2C_REG_LOOP_STOP,
+			I2C_REG_LOOP_EVENTS,
+			I2C_REG_LOOP_COALESCED,
+			
+			// Burst read of the Snapshot struct
+			I2C_REG_SNAPSHOT,
+			
+			// Sequence number of the published register file
+			I2C_REG_SHADOW_SEQ,
+			
+			// Status bits changed since the last read, cleared on read
+			I2C_REG_IRQ_CHANGED,
+			// Status bits which raise I2C_IRQ
+			I2C_REG_IRQ_MASK,
+			
+			// Write: start an ADC measurement now, MEASURE_READY is set when its values are published
+			I2C_REG_MEASURE,
+			// Age of the published ADC values, ms
+			I2C_REG_SAMPLE_AGE,
+			
+			// Deadbands of the *_MOVED events in units of the value (mV, m°C, m%), 0 - disabled
+			I2C_REG_DEADBAND_VBAT,
+			I2C_REG_DEADBAND_DCIN,
+			I2C_REG_DEADBAND_BAT_TEMP,
+			I2C_REG_DEADBAND_BAT_PCT,
+			
+			// Read: seq of the first unread history record | unread count << 16, write: ack up to the seq
+			I2C_REG_HISTORY_CURSOR,
+			// Long read of the unread History::Record's from the cursor up to the end of the ring, 0xFF after them
+			I2C_REG_HISTORY,
+			
+			// Write: trigger (0 - stop, 1 - now, 2 - below, 3 - above) | AnalogMon channel << 8 | threshold mV << 16
+			// Read: AnalogMon::CaptureState | sample count << 16
+			I2C_REG_CAPTURE,
+			// Long read of the captured samples, uint16 mV, when CAPTURE_READY
+			I2C_REG_CAPTURE_DATA,
+			
+			// Unix time of the RTC alarm, 0 - disabled. Powers on the system after USER_POWER_OFF, also from deep sleep
+			I2C_REG_RTC_ALARM,
+			
+			// 1 - analog watchdog of VBAT and DCIN while powered on, 0 - disabled (default).
+			// Keeps the MCU out of STOP while armed, the powered-on idle is spent in SLEEP instead.
+			I2C_REG_ADC_WATCH,
+		};
+		
+		enum Deadband {
+			DEADBAND_VBAT,
+			DEADBAND_DCIN,
+			DEADBAND_BAT_TEMP,
+			DEADBAND_BAT_PCT,
+			DEADBAND_COUNT
+		};
+		
+		// All telemetry of one host refresh in a single transfer, fits the 32-byte I2C buffer
+		static constexpr uint8_t SNAPSHOT_VERSION = 2;
+		
+		struct __attribute__((packed)) Snapshot {
+			uint8_t version;
+			uint8_t size;
+			uint16_t seq;
+			uint32_t status;
+			uint16_t bat_voltage;
+			uint16_t dcin_voltage;
+			int32_t bat_temp;
+			int32_t bat_pct;
+			int32_t cpu_temp;
+			uint32_t rtc_time;
+			uint32_t sample_age;	// ms since the ADC scan of the values above
+		};
+		static_assert(sizeof(Snapshot) <= 32, "Snapshot doesn't fit I2C buffer");
+		
+		enum TaskId {
+			TASK_ANALOG_MON,
+			TASK_WATCHDOG,
+			TASK_IRQ_PULSE,
+			TASK_ALARM,
+			TASK_COUNT
 		};
 		
 		enum ChrgFailureReason {
@@ -72,26 +180,61 @@ class App {
 		};
 		
 		ChrgFailureReason m_last_chrg_failure = CHRG_FAIL_NONE;
-		int64_t m_last_chrg_failure_time = 0;
+		uint32_t m_last_chrg_failure_time = 0;
 		int m_last_chrg_failure_cnt = 0;
 		int m_dcin_bad_cnt = 0;
-		int64_t m_last_charging = 0;
-		int64_t m_dcin_connected = 0;
-		int64_t m_last_pwron = 0;
-		int64_t m_last_info_print = 0;
+		uint32_t m_last_charging = 0;
+		uint32_t m_dcin_connected = 0;
+		uint32_t m_last_pwron = 0;
+		uint32_t m_last_info_print = 0;
 		uint32_t m_buzzer_freq = 0;
 		uint32_t m_buzzer_vol = 0;
+		uint32_t m_selected_task = TASK_ANALOG_MON;
+		
+		// On-demand measurement: requested, then waiting for the scan started after the request
+		bool m_measure_req = false;
+		bool m_measure_scan = false;
+		
+		// Value last reported by the *_MOVED event of each deadband
+		int m_deadband[DEADBAND_COUNT] = {};
+		int m_deadband_ref[DEADBAND_COUNT] = {};
 		
 		PwrOnFailureReason m_last_pwron_fail = PWR_FAIL_NONE;
 		
+		// Unix time, 0 - disabled, kept in RTC_BKPXR(2) for the wakeup from deep sleep
+		uint32_t m_alarm_time = 0;
+		
+		bool m_adc_watch = false;
+		
 		Task m_task_analog_mon;
 		Task m_task_watchdog;
 		Task m_task_irq_pulse;
+		Task m_task_alarm;
+		Event m_irq_ack;
+		
+		// Register file published by the loop, the I2C ISR only reads the stable half
+		struct Shadow {
+			Snapshot snapshot;
+			uint32_t rtc_ms;	// Loop::ms() at the start of the snapshot.rtc_time second
+			uint32_t sample_ms;	// Loop::ms() of the ADC scan
+			uint32_t irq_seq;	// m_irq_seq of the published changes
+		};
+		Shadow m_shadow[2] = {};
+		volatile uint8_t m_shadow_idx = 0;
+		uint16_t m_shadow_seq = 0;
+		Event m_publish;
+		
+		uint32_t getShadowRtcTime(const Shadow &shadow);
 		
 		uint32_t m_state = 0;
+		uint32_t m_irq_mask = 0xFFFFFFFF;
+		uint32_t m_irq_changed = 0;				// since the last publish
+		uint32_t m_irq_seq = 0;					// IRQ pulses raised, events included
+		volatile uint32_t m_irq_latched = 0;	// published, until the host reads it
 		Button m_pwr_key = {};
 		Button m_charger_status = {};
 		AnalogMon m_mon;
+		History m_history;
 		
 		void initHw();
 		void check();
@@ -101,6 +244,13 @@ class App {
 		}
 		
 		bool setStateBit(uint32_t bit, bool value);
+		void raiseIrq(uint32_t bit);
+		
+		void setAlarm(uint32_t time);
+		void scheduleAlarm();
+		
+		int getDeadbandValue(Deadband id);
+		void checkDeadbands();
 		
 		void checkBatteryTemp(const char *name, int min, int max, Flags flag_lo, Flags flag_hi);
 		ChrgFailureReason checkChargingAllowed();
@@ -110,24 +260,38 @@ class App {
 		uint32_t getTimeoutForChrgFail();
 		const char *getEnumName(ChrgFailureReason reason);
 		const char *getEnumName(PwrOnFailureReason reason);
+		const char *getEnumName(TaskId id);
+		
+		Task *getTask(uint32_t id);
+		int getBatPct();
+		void dumpSchedStats();
 	public:
 		int run();
+		void analogScanTask(void *);
 		void monitorTask(void *);
 		void watchdogTask(void *);
 		void irqPulseTask(void *);
+		void alarmTask(void *);
+		void onIrqAck(void *, uint32_t irq_seq);
+		void publishShadow(void *, uint32_t);
 		
 		void onDcinChange(void *, bool state);
 		void onBatChange(void *, bool state);
+		void onAnalogWatch(void *);
+		void onCaptureDone(void *);
 		void onChargerStatus(void *, Button::Event evt);
 		void onPwrKey(void *, Button::Event evt);
 		
 		void onI2C(void *, I2CSlave::Event ev, uint8_t *byte);
 		uint32_t readReg(void *, uint8_t reg);
+		uint32_t readStream(void *, uint8_t reg, const uint8_t **data);
+		uint32_t readBlock(void *, uint8_t reg, uint8_t *buffer, uint32_t size);
 		void writeReg(void *, uint8_t reg, uint32_t value);
 		
 		bool idleHook(void *);
 		
 		void allowDeepSleep(bool flag);
+		void updateStopMode();
 		
 		bool isPowerOnAllowed();
 		void powerOn();
@@ -24,15 +24,15 @@ void Buzzer::play(uint32_t freq, uint32_t duty_pct) {
 	uint32_t apr = 0;
 	uint32_t psc = 0;
 	
-	freq = std::max(20UL, std::min(20000UL, freq));
-	duty_pct = std::min(100UL, duty_pct);
+	freq = std::max<uint32_t>(20, std::min<uint32_t>(20000, freq));
+	duty_pct = std::min<uint32_t>(100, duty_pct);
 	
 	do {
 		psc++;
 		apr = rcc_apb1_frequency / (psc * freq);
 	} while (apr >= 0xFFFF);
 	
-	uint32_t duty_period = duty_pct > 0 ? std::max(1UL, ((apr / 2) * duty_pct / 100)) : 1;
+	uint32_t duty_period = duty_pct > 0 ? std::max<uint32_t>(1, ((apr / 2) * duty_pct / 100)) : 1;
 	
 	ENTER_CRITICAL();
 	timer_set_prescaler(TIM14, psc - 1);
@@ -10,4 +10,8 @@ class Buzzer {
 		static void init();
 		static void play(uint32_t freq, uint32_t duty_pct);
 		static void stop();
+		
+		static inline bool isPlaying() {
+			return m_playing;
+		}
 };
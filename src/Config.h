@@ -5,19 +5,90 @@
 #define DEBUG						1	// USART debug
 #define DEBUG_CALIBRATE_RTC			0	// Output RTC freq to USART_TX pin
 #define DEBUG_CALIBRATE_BAT_TEMP	0	// Output bat temp in voltage
+#define DEBUG_SCHED_STATS			0	// Dump scheduler stats with battery info
 
 namespace Config {
 	constexpr uint32_t WATCHDOG_TIMEOUT				= 30000;
 	
+	// Timer slack of periodic tasks, as 1/N of their period
+	constexpr uint32_t TASK_SLACK_DIV				= 4;
+	
+	// Max count of simultaneously scheduled tasks
+	constexpr uint32_t MAX_TASKS					= 16;
+	
+	// Max count of ISR-to-loop events
+	constexpr uint32_t MAX_EVENTS					= 12;
+	
 	constexpr uint32_t CHARGING_BAD_TEMP_TIMEOUT	= 1000 * 60 * 30;
 	constexpr uint32_t CHARGING_LOST_DCIN_TIMEOUT	= 1000 * 5;
 	constexpr uint32_t CHARGING_BAD_DCIN_TIMEOUT	= 1000 * 60 * 30;
 	constexpr uint32_t MIN_CHARGE_TIME				= 1000 * 60;
 	
+	// ADC oversampling: scans averaged per measurement, all of them in one DMA transfer
+	// Each scan of 5 channels at 239.5 cycles takes ~90 us and 10 bytes of RAM
+	constexpr uint32_t ADC_AVG_CNT					= 10;
+	
+	// ADC analog watchdog while powered on: VBAT and DCIN conversion interval (TIM3 triggered)
+	constexpr uint32_t ADC_WATCH_INTERVAL			= 100;
+	
+	// Monitor interval with good DCIN and no charging, when the analog watchdog covers it
+	constexpr uint32_t ADC_WATCH_IDLE_POLL			= 5000;
+	
+	// Waveform capture of DCIN or VBAT: samples per capture (2 bytes of RAM each) and rate in Hz (TIM3 triggered)
+	constexpr uint32_t ADC_CAPTURE_SIZE				= 128;
+	constexpr uint32_t ADC_CAPTURE_RATE				= 10000;
+	
+	// Telemetry history: one 16-byte record per interval, 48 records cover 12 hours
+	constexpr uint32_t HISTORY_INTERVAL				= 1000 * 60 * 15;
+	constexpr uint32_t HISTORY_SIZE					= 48;
+	
+	// I2C kernel clock (HSI)
+	constexpr uint32_t I2C_CLOCK					= 8000000;
+	
+	// I2C timing presets for the 8 MHz kernel clock (RM0360, I2C timing examples), checked in I2CSlave.cpp
+	// Digital filter is off, the address match can't wake up from STOP with it (WUPEN), the analog filter is used
+	constexpr I2CTiming I2C_SM_100K = {
+		.speed	= 100000,
+		.presc	= 1,
+		.scll	= 0x13,
+		.sclh	= 0x0F,
+		.sdadel	= 0x2,
+		.scldel	= 0x4,
+		.dnf	= 0
+	};
+	
+	constexpr I2CTiming I2C_FM_400K = {
+		.speed	= 400000,
+		.presc	= 0,
+		.scll	= 0x09,
+		.sclh	= 0x03,
+		.sdadel	= 0x1,
+		.scldel	= 0x3,
+		.dnf	= 0
+	};
+	
+	// Also turns on the Fm+ drive of the I2C pins, 8 MHz is too slow for 1 MHz
+	constexpr I2CTiming I2C_FMP_500K = {
+		.speed	= 500000,
+		.presc	= 0,
+		.scll	= 0x06,
+		.sclh	= 0x03,
+		.sdadel	= 0x0,
+		.scldel	= 0x1,
+		.dnf	= 0
+	};
+	
+	// Bus speed of the slave
+	constexpr I2CTiming I2C_TIMING					= I2C_SM_100K;
+	
 	// RTC calibration
 	constexpr uint32_t RTC_PRESCALER_S				= 19200;
 	constexpr uint32_t RTC_PRESCALER_A				= 1;
 	
+	// Tickless idle in STOP mode, woken up by RTC alarm
+	constexpr uint32_t STOP_MIN_IDLE_TIME			= 10;
+	constexpr uint32_t STOP_MAX_IDLE_TIME			= 1000 * 60 * 60;
+	
 	// Battery seettings
 	constexpr Battery BAT = {
 		.v_min			= d2int(3.4),
@@ -38,6 +109,10 @@ namespace Config {
 	constexpr int DCIN_RDIV	= d2int(2);
 	constexpr int VBAT_RDIV	= d2int(2);
 	
+	// Analog watchdog thresholds, values at or below them run the monitor immediately
+	constexpr int ADC_WATCH_VBAT_MIN	= BAT.v_shutdown;
+	constexpr int ADC_WATCH_DCIN_MIN	= DCIN_MIN_VOLTAGE;
+	
 	// Diode sensor for battery temperature
 	const Temp BAT_TEMP = {
 		{d2int(19), d2int(45)},
@@ -1,8 +1,14 @@
 #pragma once
 
+#include <cstdint>
+
+#ifdef HOST_BUILD
+#include <Sim.h>
+#else
 #define VREFINT_CAL (*((uint16_t *) 0x1FFFF7BA))
 #define TS_CAL1 (*((uint16_t *) 0x1FFFF7B8))
 #define TS_CAL2 (*((uint16_t *) 0x1FFFF7C2))
+#endif
 
 namespace Config {
 	struct Battery {
@@ -25,4 +31,16 @@ namespace Config {
 		int T[2];
 		int value[2];
 	};
+	
+	// I2C timing preset, TIMINGR fields for Config::I2C_CLOCK
+	// SCLL/SCLH are the SCL low/high periods of the bus the preset is tuned for, the host must not clock faster
+	struct I2CTiming {
+		uint32_t speed;
+		uint8_t presc;
+		uint8_t scll;
+		uint8_t sclh;
+		uint8_t sdadel;
+		uint8_t scldel;
+		uint8_t dnf;
+	};
 };
@@ -6,7 +6,7 @@
 #include "Config.h"
 
 #if DEBUG
-#define LOGD(fmt, ...) printf("%+-10ld | " fmt, Loop::log(), ##__VA_ARGS__)
+#define LOGD(fmt, ...) printf("%+-10ld | " fmt, (long) Loop::log(), ##__VA_ARGS__)
 #else
 #define LOGD(fmt, ...) do { } while (false)
 #endif
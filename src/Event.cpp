@@ -0,0 +1,16 @@
+#include "Loop.h"
+#include "Event.h"
+
+void Event::init(Callback callback, void *user_data) {
+	m_callback = callback;
+	m_user_data = user_data;
+	
+	if (!m_registered)
+		m_registered = Loop::addEvent(this);
+}
+
+void Event::post(uint32_t arg) {
+	m_arg = arg;
+	m_pending = true;
+	Loop::onEvent();
+}
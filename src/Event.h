@@ -0,0 +1,34 @@
+#pragma once
+
+#include <delegate/delegate.hpp>
+#include <cstdint>
+
+/*
+ * Deferred call from ISR to the main loop.
+ * Each event is a one-record slot: post() only does byte/word stores, so it is safe from any ISR
+ * without a critical section. Posting an already pending event coalesces it, the callback gets the last arg.
+ * */
+class Event {
+	public:
+		typedef delegate<void(void *, uint32_t)> Callback;
+	
+	protected:
+		Callback m_callback;
+		void *m_user_data = nullptr;
+		volatile uint32_t m_arg = 0;
+		volatile bool m_pending = false;
+		bool m_registered = false;
+		
+		friend class Loop;
+	public:
+		Event() {
+			
+		}
+		
+		void init(Callback callback, void *user_data = nullptr);
+		void post(uint32_t arg = 0);
+		
+		inline bool pending() {
+			return m_pending;
+		}
+};
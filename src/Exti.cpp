@@ -36,6 +36,7 @@ int Exti::set(uint32_t bank, uint32_t pin, Trigger trigger, Callback callback, v
 	m_channels[id].bank = bank;
 	m_channels[id].callback = callback;
 	m_channels[id].user_data = user_data;
+	m_channels[id].event.init(Event::Callback::make<&Channel::onEvent>(m_channels[id]));
 	
 	// Enable IRQ for EXTI
 	int irq_n = getIrq(id);
@@ -82,7 +83,14 @@ void Exti::handleIrq(uint8_t id) {
 	}
 	
 	exti_reset_request(exti);
-	channel.callback(channel.user_data, state);
+	
+	// Callback is called from the loop, bounces are coalesced to the last state
+	channel.event.post(state);
+}
+
+void Exti::Channel::onEvent(void *, uint32_t state) {
+	if (callback)
+		callback(user_data, state != 0);
 }
 
 void Exti::handleIrqRange(uint8_t from, uint8_t to) {
@@ -1,6 +1,7 @@
 #pragma once
 
 #include "Gpio.h"
+#include "Event.h"
 
 #include <cstdio>
 #include <libopencm3/stm32/exti.h>
@@ -28,6 +29,9 @@ class Exti {
 			Callback callback;
 			void *user_data = nullptr;
 			uint32_t bank = 0;
+			Event event;
+			
+			void onEvent(void *, uint32_t state);
 		};
 		
 		static Channel m_channels[EXTI_COUNT];
@@ -0,0 +1,95 @@
+#include "History.h"
+#include "utils.h"
+
+#include <algorithm>
+
+// Temperatures are in m°C, packed in 0.5 °C steps
+static constexpr int TEMP_STEP = 500;
+
+// Steps which cover the distance, rounded up, so the packed min/max never hide an extreme
+static int getSteps(int distance, int step, int limit) {
+	return std::clamp((distance + step - 1) / step, 0, limit);
+}
+
+void History::add(uint32_t state, const int (&values)[CHANNEL_COUNT]) {
+	if (!m_agg_cnt) {
+		m_agg_start = Loop::ms();
+		m_agg_state = 0;
+		for (int i = 0; i < CHANNEL_COUNT; i++)
+			m_agg[i] = {0, values[i], values[i]};
+	}
+	
+	for (int i = 0; i < CHANNEL_COUNT; i++) {
+		m_agg[i].sum += values[i];
+		m_agg[i].min = std::min(m_agg[i].min, values[i]);
+		m_agg[i].max = std::max(m_agg[i].max, values[i]);
+	}
+	m_agg_state |= state;
+	m_agg_cnt++;
+}
+
+int History::getAvg(Channel ch) {
+	return m_agg[ch].sum / static_cast<int32_t>(m_agg_cnt);
+}
+
+void History::packVoltage(uint8_t *out, Channel ch, int offset, int step) {
+	int avg = std::clamp((getAvg(ch) - offset + step / 2) / step, 0, 255);
+	int avg_mv = avg * step + offset;
+	out[0] = avg;
+	out[1] = getSteps(avg_mv - m_agg[ch].min, step, 255);
+	out[2] = getSteps(m_agg[ch].max - avg_mv, step, 255);
+}
+
+void History::packTemp(int8_t *avg, uint8_t *range, Channel ch) {
+	int value = getAvg(ch);
+	*avg = std::clamp((value + (value < 0 ? -TEMP_STEP : TEMP_STEP) / 2) / TEMP_STEP, -128, 127);
+	int avg_temp = *avg * TEMP_STEP;
+	*range = getSteps(avg_temp - m_agg[ch].min, TEMP_STEP, 15) | getSteps(m_agg[ch].max - avg_temp, TEMP_STEP, 15) << 4;
+}
+
+void History::push(uint32_t time) {
+	if (!m_agg_cnt)
+		return;
+	
+	Record record;
+	record.time = time;
+	record.state = m_agg_state;
+	packVoltage(record.vbat, VBAT, 2500, 8);
+	packVoltage(record.dcin, DCIN, 0, 32);
+	packTemp(&record.bat_temp, &record.bat_temp_range, BAT_TEMP);
+	packTemp(&record.cpu_temp, &record.cpu_temp_range, CPU_TEMP);
+	m_agg_cnt = 0;
+	
+	// Full, the slot of the oldest unread record is taken out of the host's view before it is reused
+	if (m_unread == Config::HISTORY_SIZE)
+		m_unread = m_unread - 1;
+	
+	m_records[m_head] = record;
+	
+	ENTER_CRITICAL();
+	m_head = (m_head + 1) % Config::HISTORY_SIZE;
+	m_head_seq++;
+	m_unread = m_unread + 1;
+	EXIT_CRITICAL();
+}
+
+uint32_t History::getCursor() {
+	ENTER_CRITICAL();
+	uint32_t unread = m_unread;
+	uint16_t seq = m_head_seq - unread;
+	EXIT_CRITICAL();
+	return seq | unread << 16;
+}
+
+void History::setCursor(uint16_t seq) {
+	uint16_t acked = seq - static_cast<uint16_t>(m_head_seq - m_unread);
+	if (acked <= m_unread)
+		m_unread = m_unread - acked;
+}
+
+uint32_t History::getUnread(const uint8_t **data) {
+	uint32_t unread = m_unread;
+	uint32_t first = (m_head + Config::HISTORY_SIZE - unread) % Config::HISTORY_SIZE;
+	*data = reinterpret_cast<const uint8_t *>(&m_records[first]);
+	return std::min(unread, Config::HISTORY_SIZE - first) * sizeof(Record);
+}
@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstdint>
+
+#include "Loop.h"
+#include "Config.h"
+
+/*
+ * RAM ring of telemetry aggregates, one record per Config::HISTORY_INTERVAL.
+ * The host drains it from its read cursor, records are streamed to I2C straight from the ring.
+ * */
+class History {
+	public:
+		enum Channel {
+			VBAT,
+			DCIN,
+			BAT_TEMP,
+			CPU_TEMP,
+			CHANNEL_COUNT
+		};
+		
+		// Voltages: avg and the distance to min/max, temperatures: avg and min/max distances packed in nibbles
+		struct __attribute__((packed)) Record {
+			uint32_t time;				// RTC time at the end of the period
+			uint16_t state;				// App state bits seen during the period
+			uint8_t vbat[3];			// 8 mV, avg from 2500 mV
+			uint8_t dcin[3];			// 32 mV
+			int8_t bat_temp;			// 0.5 °C
+			uint8_t bat_temp_range;
+			int8_t cpu_temp;			// 0.5 °C
+			uint8_t cpu_temp_range;
+		};
+		static_assert(sizeof(Record) == 16, "Unexpected History::Record size");
+	
+	protected:
+		struct Aggregate {
+			int32_t sum;
+			int min;
+			int max;
+		};
+		
+		Aggregate m_agg[CHANNEL_COUNT] = {};
+		uint32_t m_agg_cnt = 0;
+		uint16_t m_agg_state = 0;
+		uint32_t m_agg_start = 0;
+		
+		Record m_records[Config::HISTORY_SIZE] = {};
+		uint32_t m_head = 0;				// index of the next record
+		uint16_t m_head_seq = 0;			// seq of the next record
+		volatile uint32_t m_unread = 0;		// records before the head which the host has not acked
+		
+		int getAvg(Channel ch);
+		void packVoltage(uint8_t *out, Channel ch, int offset, int step);
+		void packTemp(int8_t *avg, uint8_t *range, Channel ch);
+	public:
+		void add(uint32_t state, const int (&values)[CHANNEL_COUNT]);
+		
+		inline bool isDue() {
+			return m_agg_cnt && Loop::ms() - m_agg_start >= Config::HISTORY_INTERVAL;
+		}
+		
+		// Closes the period, the oldest unread record is overwritten when the ring is full
+		void push(uint32_t time);
+		
+		// Seq of the first unread record and count of the unread ones
+		uint32_t getCursor();
+		
+		// Acks the records before the seq
+		void setCursor(uint16_t seq);
+		
+		// Unread records up to the end of the ring, safe from ISR
+		uint32_t getUnread(const uint8_t **data);
+};
@@ -1,112 +1,305 @@
 #include "I2CSlave.h"
 
+#include "Config.h"
+#include "Loop.h"
 #include "Debug.h"
+#include "utils.h"
 
 #include <cstring>
 
 #include <libopencm3/stm32/i2c.h>
+#include <libopencm3/stm32/dma.h>
 #include <libopencm3/stm32/rcc.h>
+#include <libopencm3/stm32/syscfg.h>
 #include <libopencm3/cm3/nvic.h>
 
+// Fixed DMA request mapping of I2C1 on STM32F030
+static constexpr uint8_t I2C_DMA_TX = DMA_CHANNEL2;
+static constexpr uint8_t I2C_DMA_RX = DMA_CHANNEL3;
+
+/*
+ * Timing constraints of the selected preset (RM0360, I2C timings), all in ns
+ * SCL stretching is on, so only the lower bounds of the data hold/setup delays apply
+ * */
+struct I2CMode {
+	uint32_t speed;
+	int t_r;		// rise time, max
+	int t_f;		// fall time, max
+	int t_su_dat;	// data setup time, min
+};
+
+static constexpr I2CMode I2C_MODES[] = {
+	{100000,	1000,	300,	250},
+	{400000,	300,	300,	100},
+	{1000000,	120,	120,	50},
+};
+
+// Analog filter delay
+static constexpr int I2C_T_AF_MIN = 50;
+static constexpr int I2C_T_AF_MAX = 260;
+
+static constexpr auto &I2C_TIMING = Config::I2C_TIMING;
+
+static constexpr int i2cNs(uint32_t clocks) {
+	return static_cast<int>(static_cast<uint64_t>(clocks) * 1000000000 / Config::I2C_CLOCK);
+}
+
+static constexpr I2CMode getI2CMode(uint32_t speed) {
+	for (auto &mode: I2C_MODES) {
+		if (speed <= mode.speed)
+			return mode;
+	}
+	return {};
+}
+
+static constexpr I2CMode I2C_MODE = getI2CMode(I2C_TIMING.speed);
+static constexpr int I2C_T_CLK = i2cNs(1);
+static constexpr int I2C_T_PRESC = i2cNs(I2C_TIMING.presc + 1);
+
+static_assert(I2C_MODE.speed != 0, "I2C speed is above Fast-mode Plus");
+static_assert(I2C_TIMING.presc < 16 && I2C_TIMING.sdadel < 16 && I2C_TIMING.scldel < 16 && I2C_TIMING.dnf < 16,
+	"I2C timing field is out of range");
+static_assert(I2C_TIMING.sdadel * I2C_T_PRESC >= I2C_MODE.t_f - I2C_T_AF_MIN - (I2C_TIMING.dnf + 3) * I2C_T_CLK,
+	"I2C SDADEL is too short for the data hold time");
+static_assert((I2C_TIMING.scldel + 1) * I2C_T_PRESC >= I2C_MODE.t_r + I2C_MODE.t_su_dat,
+	"I2C SCLDEL is too short for the data setup time");
+static_assert(4 * I2C_T_CLK < (I2C_TIMING.scll + 1) * I2C_T_PRESC - I2C_T_AF_MAX - I2C_TIMING.dnf * I2C_T_CLK,
+	"I2C kernel clock is too slow for the SCL low period and the filters");
+static_assert(I2C_T_CLK < (I2C_TIMING.sclh + 1) * I2C_T_PRESC,
+	"I2C kernel clock is too slow for the SCL high period");
+
+// Both SCL edges are delayed by the analog filter, the digital filter and 2 kernel clocks at least
+static constexpr int I2C_T_SYNC_MIN = 2 * (I2C_T_AF_MIN + (I2C_TIMING.dnf + 2) * I2C_T_CLK);
+static_assert((I2C_TIMING.scll + 1 + I2C_TIMING.sclh + 1) * I2C_T_PRESC + I2C_T_SYNC_MIN <= static_cast<int>(1000000000 / I2C_TIMING.speed),
+	"I2C SCL period is longer than the preset speed");
+static_assert(I2C_TIMING.dnf == 0,
+	"I2C digital filter blocks the wakeup from STOP on the address match");
+
 bool I2CSlave::m_start = false;
 void *I2CSlave::m_user_data = nullptr;
 
 I2CSlave::ReadCallback I2CSlave::m_read_reg;
 I2CSlave::WriteCallback I2CSlave::m_write_reg;
+I2CSlave::ReadBlockCallback I2CSlave::m_read_block;
+I2CSlave::ReadStreamCallback I2CSlave::m_read_stream;
+
+Event I2CSlave::m_write_event;
+volatile bool I2CSlave::m_write_pending = false;
+uint8_t I2CSlave::m_write_reg_id = 0;
+uint32_t I2CSlave::m_write_value = 0;
+
+uint8_t I2CSlave::m_rx_buf[BUFFER_SIZE] = {};
+uint8_t I2CSlave::m_tx_buf[BUFFER_SIZE + 2] = {};
+uint32_t I2CSlave::m_rx_n = 0;
 
 void I2CSlave::init() {
 	rcc_set_i2c_clock_hsi(I2C1);
+	rcc_periph_clock_enable(RCC_DMA1);
 	
 	rcc_periph_reset_pulse(RST_I2C1);
 	i2c_peripheral_disable(I2C1);
 	
 	i2c_enable_analog_filter(I2C1);
-	i2c_set_digital_filter(I2C1, 0);
+	i2c_set_digital_filter(I2C1, I2C_TIMING.dnf);
 	
-	i2c_set_speed(I2C1, i2c_speed_sm_100k, 8);
+	i2c_set_prescaler(I2C1, I2C_TIMING.presc);
+	i2c_set_scl_low_period(I2C1, I2C_TIMING.scll);
+	i2c_set_scl_high_period(I2C1, I2C_TIMING.sclh);
+	i2c_set_data_hold_time(I2C1, I2C_TIMING.sdadel);
+	i2c_set_data_setup_time(I2C1, I2C_TIMING.scldel);
 	i2c_set_7bit_addr_mode(I2C1);
 	
+	// Fm+ needs the 20 mA drive of SCL (PA9) and SDA (PA10)
+	if (I2C_TIMING.speed > 400000)
+		SYSCFG_CFGR1 |= SYSCFG_CFGR1_I2C_FMP_PA9 | SYSCFG_CFGR1_I2C_FMP_PA10;
+	
+	m_write_event.init(::Event::Callback::make<&I2CSlave::applyWrite>());
+	
+	// DMA, armed on ADDR match, TC interrupt only for transfers longer than the buffers
+	dma_channel_reset(DMA1, I2C_DMA_RX);
+	dma_set_memory_size(DMA1, I2C_DMA_RX, DMA_CCR_MSIZE_8BIT);
+	dma_set_peripheral_size(DMA1, I2C_DMA_RX, DMA_CCR_PSIZE_8BIT);
+	dma_enable_memory_increment_mode(DMA1, I2C_DMA_RX);
+	dma_set_read_from_peripheral(DMA1, I2C_DMA_RX);
+	dma_set_peripheral_address(DMA1, I2C_DMA_RX, reinterpret_cast<uintptr_t>(&I2C_RXDR(I2C1)));
+	dma_set_memory_address(DMA1, I2C_DMA_RX, reinterpret_cast<uintptr_t>(&m_rx_buf));
+	dma_enable_transfer_complete_interrupt(DMA1, I2C_DMA_RX);
+	
+	dma_channel_reset(DMA1, I2C_DMA_TX);
+	dma_set_memory_size(DMA1, I2C_DMA_TX, DMA_CCR_MSIZE_8BIT);
+	dma_set_peripheral_size(DMA1, I2C_DMA_TX, DMA_CCR_PSIZE_8BIT);
+	dma_enable_memory_increment_mode(DMA1, I2C_DMA_TX);
+	dma_set_read_from_memory(DMA1, I2C_DMA_TX);
+	dma_set_peripheral_address(DMA1, I2C_DMA_TX, reinterpret_cast<uintptr_t>(&I2C_TXDR(I2C1)));
+	dma_set_memory_address(DMA1, I2C_DMA_TX, reinterpret_cast<uintptr_t>(&m_tx_buf));
+	dma_enable_transfer_complete_interrupt(DMA1, I2C_DMA_TX);
+	
+	nvic_enable_irq(NVIC_DMA1_CHANNEL2_3_IRQ);
+	
 	i2c_set_own_7bit_slave_address(I2C1, 0x34);
 	I2C_OAR1(I2C1) |= I2C_OAR1_OA1EN_ENABLE;
 	
+	// Data bytes go through DMA, RXIE/TXIE are used only past the end of the buffers
 	i2c_enable_interrupt(I2C1, (
-		I2C_CR1_RXIE | I2C_CR1_ADDRIE | I2C_CR1_STOPIE | I2C_CR1_ERRIE
+		I2C_CR1_ADDRIE | I2C_CR1_STOPIE | I2C_CR1_ERRIE
 	));
 	
 	i2c_enable_stretching(I2C1);
 	i2c_enable_autoend(I2C1);
 	I2C_CR2(I2C1) &= ~I2C_CR2_NACK;
+	
+	// Address match wakes up from STOP, HSI is kept running for the kernel clock
+	I2C_CR1(I2C1) |= I2C_CR1_WUPEN;
 	nvic_enable_irq(NVIC_I2C1_IRQ);
 	
 	i2c_peripheral_enable(I2C1);
 }
 
 void I2CSlave::handleEvent(I2CSlave::Event ev, uint8_t *byte) {
-	static uint32_t rx_n = 0;
-	static uint32_t tx_n = 0;
-	static uint8_t tmp_rx[32] = {};
-	static uint8_t tmp_tx[32] = {};
-	static bool is_read = false;
-	
 	switch (ev) {
-		case I2CSlave::EV_START_READ:
 		case I2CSlave::EV_START_WRITE:
-			is_read = (ev == I2CSlave::EV_START_READ);
+			stopTx();
+			
+			m_rx_n = 0;
+			dma_set_number_of_data(DMA1, I2C_DMA_RX, sizeof(m_rx_buf));
+			dma_enable_channel(DMA1, I2C_DMA_RX);
+			I2C_CR1(I2C1) |= I2C_CR1_RXDMAEN;
+		break;
+		
+		case I2CSlave::EV_START_READ:
+		{
+			// Register id was written before the repeated start, a read ended by a repeated start leaves TX DMA enabled
+			stopRx();
+			stopTx();
+			
+			// Flush the byte left in TXDR by the previous read
+			I2C_ISR(I2C1) |= I2C_ISR_TXE;
+			
+			// Past the end of the stream, the DMA interrupt switches to 0xFF bytes
+			const uint8_t *stream = nullptr;
+			uint32_t stream_size = (m_rx_n == 1 && m_read_stream) ? m_read_stream(m_user_data, m_rx_buf[0], &stream) : 0;
+			if (stream_size) {
+				dma_set_memory_address(DMA1, I2C_DMA_TX, reinterpret_cast<uintptr_t>(stream));
+				dma_set_number_of_data(DMA1, I2C_DMA_TX, stream_size);
+				dma_enable_channel(DMA1, I2C_DMA_TX);
+				I2C_CR1(I2C1) |= I2C_CR1_TXDMAEN;
+				break;
+			}
+			
+			memset(m_tx_buf, 0, BUFFER_SIZE);
+			m_tx_buf[BUFFER_SIZE] = 0xFF;
+			m_tx_buf[BUFFER_SIZE + 1] = 0xFF;
+			
+			if (m_rx_n == 1) {
+				uint32_t size = m_read_block ? m_read_block(m_user_data, m_rx_buf[0], m_tx_buf, BUFFER_SIZE) : 0;
+				if (!size && m_read_reg) {
+					uint32_t result = m_read_reg(m_user_data, m_rx_buf[0]);
+					memcpy(m_tx_buf, &result, sizeof(result));
+				}
+			}
+			
+			dma_set_memory_address(DMA1, I2C_DMA_TX, reinterpret_cast<uintptr_t>(&m_tx_buf));
+			dma_set_number_of_data(DMA1, I2C_DMA_TX, sizeof(m_tx_buf));
+			dma_enable_channel(DMA1, I2C_DMA_TX);
+			I2C_CR1(I2C1) |= I2C_CR1_TXDMAEN;
+		}
 		break;
 		
 		case I2CSlave::EV_STOP:
-			if (rx_n == 5) {
-				uint32_t value;
-				memcpy(&value, &tmp_rx[1], sizeof(value));
-				if (m_write_reg)
-					m_write_reg(m_user_data, tmp_rx[0], value);
+			stopRx();
+			stopTx();
+			
+			if (m_rx_n == 5) {
+				m_write_reg_id = m_rx_buf[0];
+				memcpy(&m_write_value, &m_rx_buf[1], sizeof(m_write_value));
+				m_write_pending = true;
+				m_write_event.post();
 			}
 			
-			rx_n = 0;
-			tx_n = 0;
-			memset(&tmp_rx, 0, sizeof(tmp_rx));
-			memset(&tmp_tx, 0, sizeof(tmp_tx));
+			m_rx_n = 0;
 		break;
 		
 		case I2CSlave::EV_RX:
-			if (rx_n < sizeof(tmp_rx))
-				tmp_rx[rx_n++] = *byte;
+			// Past the end of the buffer, dropped
 		break;
 		
 		case I2CSlave::EV_TX:
-			if (is_read && tx_n == 0 && rx_n == 1 && m_read_reg) {
-				uint32_t result = m_read_reg(m_user_data, tmp_rx[0]);
-				memcpy(tmp_tx, &result, sizeof(result));
-			}
-			
-			if (tx_n < sizeof(tmp_tx))
-				*byte = tmp_tx[tx_n++] & 0xFF;
+			*byte = 0xFF;
 		break;
 	}
 }
 
+void I2CSlave::stopRx() {
+	if ((I2C_CR1(I2C1) & I2C_CR1_RXDMAEN)) {
+		I2C_CR1(I2C1) &= ~I2C_CR1_RXDMAEN;
+		m_rx_n = sizeof(m_rx_buf) - dma_get_number_of_data(DMA1, I2C_DMA_RX);
+	}
+	I2C_CR1(I2C1) &= ~I2C_CR1_RXIE;
+	dma_disable_channel(DMA1, I2C_DMA_RX);
+}
+
+// DMA and the stretched SCL need clocks, no STOP from the address match until the end of the transfer
+void I2CSlave::setBusy(bool flag) {
+	if (m_start == flag)
+		return;
+	
+	m_start = flag;
+	if (flag) {
+		Loop::lockStop();
+	} else {
+		Loop::unlockStop();
+	}
+}
+
+void I2CSlave::stopTx() {
+	I2C_CR1(I2C1) &= ~(I2C_CR1_TXDMAEN | I2C_CR1_TXIE);
+	dma_disable_channel(DMA1, I2C_DMA_TX);
+}
+
+void I2CSlave::applyWrite(void *, uint32_t) {
+	if (m_write_reg)
+		m_write_reg(m_user_data, m_write_reg_id, m_write_value);
+	
+	// Release the bus, if the next transfer is waiting for this write
+	ENTER_CRITICAL();
+	m_write_pending = false;
+	I2C_CR1(I2C1) |= I2C_CR1_ADDRIE;
+	EXIT_CRITICAL();
+}
+
 void I2CSlave::irqHandler() {
 	uint32_t irq_flags = I2C_ISR(I2C1);
 	if ((irq_flags & I2C_ISR_STOPF)) {
-		I2C_CR1(I2C1) &= ~I2C_CR1_TXIE;
 		I2C_ICR(I2C1) |= I2C_ICR_STOPCF;
 		
 		handleEvent(EV_STOP, nullptr);
+		setBusy(false);
 	} else if ((irq_flags & I2C_ISR_ADDR)) {
-		I2C_ICR(I2C1) |= I2C_ICR_ADDRCF;
+		setBusy(true);
+		
+		// SCL is stretched while ADDR is set, so the next transfer always sees the previous write applied
+		if (m_write_pending) {
+			I2C_CR1(I2C1) &= ~I2C_CR1_ADDRIE;
+			return;
+		}
 		
+		// DMA is armed before the bus is released
 		if ((irq_flags & I2C_ISR_DIR_READ)) {
-			I2C_ISR(I2C1) |= I2C_ISR_TXE;
-			I2C_CR1(I2C1) |= I2C_CR1_TXIE;
-			
 			handleEvent(EV_START_READ, nullptr);
 		} else {
 			handleEvent(EV_START_WRITE, nullptr);
 		}
+		
+		I2C_ICR(I2C1) |= I2C_ICR_ADDRCF;
 	} else if ((irq_flags & (I2C_ISR_BERR | I2C_ISR_OVR))) {
-		I2C_CR1(I2C1) &= ~I2C_CR1_TXIE;
+		stopRx();
+		stopTx();
 		I2C_ICR(I2C1) |= I2C_ICR_BERRCF | I2C_ICR_OVRCF;
-	} else if ((irq_flags & I2C_ISR_RXNE)) {
+		
+		// Misplaced START/STOP, the transfer is over
+		if ((irq_flags & I2C_ISR_BERR))
+			setBusy(false);
+	} else if ((I2C_CR1(I2C1) & I2C_CR1_RXIE) && (irq_flags & I2C_ISR_RXNE)) {
 		uint8_t data = I2C_RXDR(I2C1) & 0xFF;
 		handleEvent(EV_RX, &data);
 	} else if ((I2C_CR1(I2C1) & I2C_CR1_TXIE) && (irq_flags & I2C_ISR_TXIS)) {
@@ -116,6 +309,25 @@ void I2CSlave::irqHandler() {
 	}
 }
 
+void I2CSlave::dmaIrqHandler() {
+	// Transfer is longer than the buffer, the rest goes byte by byte through the I2C interrupt
+	if (dma_get_interrupt_flag(DMA1, I2C_DMA_RX, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, I2C_DMA_RX, DMA_TCIF);
+		stopRx();
+		I2C_CR1(I2C1) |= I2C_CR1_RXIE;
+	}
+	
+	if (dma_get_interrupt_flag(DMA1, I2C_DMA_TX, DMA_TCIF)) {
+		dma_clear_interrupt_flags(DMA1, I2C_DMA_TX, DMA_TCIF);
+		stopTx();
+		I2C_CR1(I2C1) |= I2C_CR1_TXIE;
+	}
+}
+
 void i2c1_isr() {
 	I2CSlave::irqHandler();
 }
+
+void dma1_channel2_3_isr() {
+	I2CSlave::dmaIrqHandler();
+}
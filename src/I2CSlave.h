@@ -4,6 +4,8 @@
 #include <cstdint>
 #include <delegate/delegate.hpp>
 
+#include "Event.h"
+
 class I2CSlave {
 	public:
 		enum Event {
@@ -16,16 +18,45 @@ class I2CSlave {
 		
 		typedef delegate<uint32_t(void *, uint8_t)> ReadCallback;
 		typedef delegate<void(void *, uint8_t, uint32_t)> WriteCallback;
+		
+		// Fills up to `size` bytes of a multi-byte register, returns 0 for the plain 32-bit ones
+		typedef delegate<uint32_t(void *, uint8_t, uint8_t *, uint32_t)> ReadBlockCallback;
+		
+		// Points to the data of a long register, sent by DMA straight from there, returns 0 if it is not one
+		typedef delegate<uint32_t(void *, uint8_t, const uint8_t **)> ReadStreamCallback;
 	
 	protected:
+		static constexpr uint32_t BUFFER_SIZE = 32;
+		
+		// Between the address match and STOP
 		static bool m_start;
 		static ReadCallback m_read_reg;
 		static WriteCallback m_write_reg;
+		static ReadBlockCallback m_read_block;
+		static ReadStreamCallback m_read_stream;
 		static void *m_user_data;
+		
+		// Last received write, applied by the loop
+		static ::Event m_write_event;
+		static volatile bool m_write_pending;
+		static uint8_t m_write_reg_id;
+		static uint32_t m_write_value;
+		
+		// DMA buffers of the current transfer
+		// TX has two 0xFF bytes past the data: TXDR is preloaded ahead, so a full read never completes the DMA
+		static uint8_t m_rx_buf[BUFFER_SIZE];
+		static uint8_t m_tx_buf[BUFFER_SIZE + 2];
+		static uint32_t m_rx_n;
+		
+		static void applyWrite(void *, uint32_t);
+		static void stopRx();
+		static void stopTx();
+		static void setBusy(bool flag);
 	
 	public:
 		static void init();
 		static void irqHandler();
+		static void dmaIrqHandler();
 		static void handleEvent(Event ev, uint8_t *byte);
 		
 		static inline void setCallback(ReadCallback read_reg, WriteCallback write_reg, void *user_data = nullptr) {
@@ -33,4 +64,17 @@ class I2CSlave {
 			m_write_reg = write_reg;
 			m_user_data = user_data;
 		}
+		
+		static inline void setReadBlockCallback(ReadBlockCallback read_block) {
+			m_read_block = read_block;
+		}
+		
+		static inline void setReadStreamCallback(ReadStreamCallback read_stream) {
+			m_read_stream = read_stream;
+		}
+		
+		// Transfer is in progress, streamed data must stay intact
+		static inline bool isBusy() {
+			return m_start;
+		}
 };
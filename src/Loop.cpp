@@ -1,4 +1,6 @@
 #include "Loop.h"
+#include "RTC.h"
+#include "utils.h"
 
 #include <libopencm3/stm32/rcc.h>
 #include <libopencm3/stm32/pwr.h>
@@ -8,11 +10,19 @@
 #include <algorithm>
 #include <cstdio>
 
-Task *Loop::m_first = nullptr;
-Task *Loop::m_last = nullptr;
+Task *Loop::m_queue[Config::MAX_TASKS] = {};
+uint32_t Loop::m_queue_size = 0;
 uint32_t Loop::m_changed = 0;
-int64_t Loop::m_last_log = 0;
-volatile int64_t Loop::m_ticks = 0;
+uint32_t Loop::m_last_log = 0;
+volatile uint32_t Loop::m_ticks = 0;
+volatile uint32_t Loop::m_ticks_hi = 0;
+Loop::Stats Loop::m_stats = {};
+bool Loop::m_stop_allowed = false;
+volatile uint8_t Loop::m_stop_locks = 0;
+uint32_t Loop::m_stop_remainder = 0;
+Event *Loop::m_events[Config::MAX_EVENTS] = {};
+uint32_t Loop::m_events_count = 0;
+volatile bool Loop::m_events_pending = false;
 
 uint32_t m_max_idle_time = 0;
 uint32_t m_counts_per_tick = 0;
@@ -34,42 +44,225 @@ void Loop::init() {
 }
 
 void Loop::run() {
+	bool after_sleep = false;
+	uint32_t wakeup = 0;
+	
 	while (true) {
-		Task *task = m_first;
-		int64_t m_next_run = ms() + m_max_idle_time;
+		m_stats.iterations++;
+		
+		if (m_events_pending)
+			dispatchEvents();
+		
 		uint32_t changed_before = m_changed;
-		int processed = 0;
+		uint32_t now = ms();
 		
-		while (task) {
-			Task *next = task->next();
-			if (task->enabled()) {
-				if (ms() >= task->nextRun())
-					task->exec();
-				
-				if (task->enabled())
-					m_next_run = std::min(m_next_run, task->nextRun());
-				
-				processed++;
-			}
-			task = next;
+		Task *task;
+		while ((task = first()) && timeDiff(now, task->nextRun()) >= 0) {
+			// Due before the wakeup, its slack moved it to share the wakeup
+			if (after_sleep && timeDiff(task->nextRun(), wakeup) < 0)
+				m_stats.coalesced++;
+			task->exec();
 		}
+		after_sleep = false;
 		
-		if (changed_before == m_changed) {
-			if (!processed) {
+		if (changed_before == m_changed && !m_events_pending) {
+			if (!m_queue_size) {
 				if (m_idle_callback && m_idle_callback(m_idle_callback_data))
 					continue;
 			}
 			
-			int64_t time_for_idle = m_next_run - ms();
+			// Nothing is delayed without tasks, the ones added while sleeping are due after now
+			wakeup = m_queue_size ? nextWakeup() : now;
+			
+			if (m_stop_allowed && !m_stop_locks) {
+				int32_t time_for_idle = m_queue_size ? timeDiff(wakeup, ms()) : static_cast<int32_t>(Config::STOP_MAX_IDLE_TIME);
+				if (time_for_idle >= static_cast<int32_t>(Config::STOP_MIN_IDLE_TIME)) {
+					m_stats.wfi++;
+					m_stats.stop++;
+					stopFor(time_for_idle);
+					after_sleep = true;
+					continue;
+				}
+			}
+			
+			int32_t time_for_idle = timeDiff(m_queue_size ? wakeup : now + m_max_idle_time, ms());
 			if (time_for_idle == 1) {
-				__asm__ volatile("wfi");
+				m_stats.wfi++;
+				WAIT_FOR_INTERRUPT();
+				after_sleep = true;
 			} else if (time_for_idle > 1) {
+				m_stats.wfi++;
+				m_stats.idle++;
 				idleFor(time_for_idle);
+				after_sleep = true;
 			}
 		}
 	}
 }
 
+void Loop::lockStop() {
+	ENTER_CRITICAL();
+	m_stop_locks++;
+	EXIT_CRITICAL();
+}
+
+void Loop::unlockStop() {
+	ENTER_CRITICAL();
+	m_stop_locks--;
+	EXIT_CRITICAL();
+}
+
+uint32_t Loop::nextWakeup() {
+	/*
+	 * Latest time which is still inside the slack window of every queued task, and the last deadline before it:
+	 * slack is used only when it saves a wakeup. Tasks due after the limit can't lower it,
+	 * so the heap is walked only down to the nodes due before it, later subtrees are skipped.
+	 * */
+	uint32_t limit = m_queue[0]->m_next_run + m_queue[0]->m_slack;
+	
+	uint8_t stack[Config::MAX_TASKS];
+	uint32_t stack_size = 0;
+	uint8_t visited[Config::MAX_TASKS];
+	uint32_t visited_cnt = 0;
+	
+	stack[stack_size++] = 0;
+	while (stack_size) {
+		uint32_t index = stack[--stack_size];
+		const Task *task = m_queue[index];
+		if (timeDiff(task->m_next_run, limit) > 0)
+			continue;
+		
+		if (timeDiff(task->m_next_run + task->m_slack, limit) < 0)
+			limit = task->m_next_run + task->m_slack;
+		visited[visited_cnt++] = index;
+		
+		for (uint32_t child = index * 2 + 1; child <= index * 2 + 2 && child < m_queue_size; child++)
+			stack[stack_size++] = child;
+	}
+	
+	// The limit only moved down, nodes visited before that may be past it
+	uint32_t wakeup = m_queue[0]->m_next_run;
+	for (uint32_t i = 1; i < visited_cnt; i++) {
+		uint32_t next_run = m_queue[visited[i]]->m_next_run;
+		if (timeDiff(next_run, limit) <= 0 && timeDiff(next_run, wakeup) > 0)
+			wakeup = next_run;
+	}
+	return wakeup;
+}
+
+uint64_t Loop::ms64() {
+	uint32_t hi, lo;
+	
+	// Retry if SysTick wrapped the low word between the two reads
+	do {
+		hi = m_ticks_hi;
+		lo = m_ticks;
+	} while (hi != m_ticks_hi);
+	
+	return (static_cast<uint64_t>(hi) << 32) | lo;
+}
+
+uint32_t Loop::us() {
+	uint32_t ticks;
+	uint32_t counts;
+	
+	// Retry if SysTick fired between the two reads
+	do {
+		ticks = m_ticks;
+		counts = STK_CVR;
+	} while (ticks != m_ticks);
+	
+	// Zero means the counter was just restarted and not reloaded yet
+	counts = counts ? m_counts_per_tick - counts : 0;
+	
+	return ticks * 1000 + counts * 1000 / m_counts_per_tick;
+}
+
+bool Loop::addEvent(Event *event) {
+	if (m_events_count >= Config::MAX_EVENTS) {
+		printf("Loop: too many events, increase Config::MAX_EVENTS!\r\n");
+		return false;
+	}
+	
+	m_events[m_events_count++] = event;
+	return true;
+}
+
+void Loop::dispatchEvents() {
+	// Cleared before the scan, so an event posted during the scan is picked up on the next iteration
+	m_events_pending = false;
+	
+	for (uint32_t i = 0; i < m_events_count; i++) {
+		Event *event = m_events[i];
+		if (!event->m_pending)
+			continue;
+		
+		event->m_pending = false;
+		uint32_t arg = event->m_arg;
+		
+		m_stats.events++;
+		if (event->m_callback)
+			event->m_callback(event->m_user_data, arg);
+	}
+}
+
+bool Loop::schedule(Task *task) {
+	if (m_queue_size >= Config::MAX_TASKS) {
+		printf("Loop: too many tasks, increase Config::MAX_TASKS!\r\n");
+		return false;
+	}
+	
+	place(m_queue_size, task);
+	siftUp(m_queue_size++);
+	return true;
+}
+
+void Loop::reschedule(Task *task) {
+	siftUp(task->m_queue_index);
+	siftDown(task->m_queue_index);
+}
+
+void Loop::unschedule(Task *task) {
+	uint32_t index = task->m_queue_index;
+	Task *last = m_queue[--m_queue_size];
+	
+	task->m_queue_index = Task::NOT_QUEUED;
+	m_queue[m_queue_size] = nullptr;
+	
+	if (task != last) {
+		place(index, last);
+		reschedule(last);
+	}
+}
+
+void Loop::siftUp(uint32_t index) {
+	Task *task = m_queue[index];
+	while (index > 0) {
+		uint32_t parent = (index - 1) / 2;
+		if (timeDiff(m_queue[parent]->m_next_run, task->m_next_run) <= 0)
+			break;
+		place(index, m_queue[parent]);
+		index = parent;
+	}
+	place(index, task);
+}
+
+void Loop::siftDown(uint32_t index) {
+	Task *task = m_queue[index];
+	while (true) {
+		uint32_t child = index * 2 + 1;
+		if (child >= m_queue_size)
+			break;
+		if (child + 1 < m_queue_size && timeDiff(m_queue[child + 1]->m_next_run, m_queue[child]->m_next_run) < 0)
+			child++;
+		if (timeDiff(task->m_next_run, m_queue[child]->m_next_run) <= 0)
+			break;
+		place(index, m_queue[child]);
+		index = child;
+	}
+	place(index, task);
+}
+
 void Loop::suspend(bool standby) {
 	rcc_periph_clock_enable(RCC_PWR);
 	
@@ -87,7 +280,7 @@ void Loop::suspend(bool standby) {
 	
 	SCB_SCR |= SCB_SCR_SLEEPDEEP;
 	
-	__asm__ volatile("wfi");
+	WAIT_FOR_INTERRUPT();
 	
 	SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
 }
@@ -99,9 +292,16 @@ void Loop::idleFor(uint32_t idle_time) {
 	systick_counter_disable();
 	
 	// Disable irq
-	__asm__ volatile("cpsid i" ::: "memory");
-	__asm__ volatile("dsb");
-	__asm__ volatile("isb");
+	DISABLE_INTERRUPTS();
+	DATA_SYNC_BARRIER();
+	INSTRUCTION_SYNC_BARRIER();
+	
+	// Event was posted after the loop checked for it
+	if (m_events_pending) {
+		systick_counter_enable();
+		ENABLE_INTERRUPTS();
+		return;
+	}
 	
 	// Setup systick for waiting idle_time ms
 	uint32_t reload_val = systick_get_value() + (m_counts_per_tick * (idle_time - 1));
@@ -110,18 +310,18 @@ void Loop::idleFor(uint32_t idle_time) {
 	systick_counter_enable();
 	
 	// Do sleep
-	__asm__ volatile("dsb" ::: "memory");
-	__asm__ volatile("wfi");
-	__asm__ volatile("isb");
+	DATA_SYNC_BARRIER();
+	WAIT_FOR_INTERRUPT();
+	INSTRUCTION_SYNC_BARRIER();
 	
 	#if 0
 	// Allow process irq fired after sleep
-	__asm__ volatile("cpsie i" ::: "memory");
-	__asm__ volatile("dsb");
-	__asm__ volatile("isb");
-	__asm__ volatile("cpsid i" ::: "memory");
-	__asm__ volatile("dsb");
-	__asm__ volatile("isb");
+	ENABLE_INTERRUPTS();
+	DATA_SYNC_BARRIER();
+	INSTRUCTION_SYNC_BARRIER();
+	DISABLE_INTERRUPTS();
+	DATA_SYNC_BARRIER();
+	INSTRUCTION_SYNC_BARRIER();
 	#endif
 	
 	// Recalc internal ticks counter
@@ -129,9 +329,9 @@ void Loop::idleFor(uint32_t idle_time) {
 	systick_counter_disable();
 	
 	if (counted_to_zero) {
-		m_ticks += idle_time - 1;
+		advance(idle_time - 1);
 	} else {
-		m_ticks += ((idle_time * m_counts_per_tick) - systick_get_value()) / m_counts_per_tick;
+		advance(((idle_time * m_counts_per_tick) - systick_get_value()) / m_counts_per_tick);
 	}
 	
 	// Restart systick
@@ -140,7 +340,55 @@ void Loop::idleFor(uint32_t idle_time) {
 	systick_counter_enable();
 	
 	// Enable irq
-	__asm__ volatile("cpsie i" ::: "memory");
+	ENABLE_INTERRUPTS();
+}
+
+void Loop::stopFor(uint32_t idle_time) {
+	idle_time = std::min(idle_time, Config::STOP_MAX_IDLE_TIME);
+	
+	// SysTick is stopped in STOP mode, RTC is used instead
+	systick_counter_disable();
+	
+	DISABLE_INTERRUPTS();
+	DATA_SYNC_BARRIER();
+	INSTRUCTION_SYNC_BARRIER();
+	
+	// Event was posted or STOP was locked (I2C address match) after the loop checked for it
+	if (m_events_pending || m_stop_locks || !m_stop_allowed) {
+		systick_counter_enable();
+		ENABLE_INTERRUPTS();
+		return;
+	}
+	
+	uint32_t start = RTC::ticks();
+	RTC::setWakeup(start + static_cast<uint64_t>(idle_time) * RTC::TICKS_PER_SECOND / 1000);
+	
+	pwr_voltage_regulator_low_power_in_stop();
+	pwr_set_stop_mode();
+	SCB_SCR |= SCB_SCR_SLEEPDEEP;
+	
+	// Do sleep
+	DATA_SYNC_BARRIER();
+	WAIT_FOR_INTERRUPT();
+	INSTRUCTION_SYNC_BARRIER();
+	
+	SCB_SCR &= ~SCB_SCR_SLEEPDEEP;
+	
+	RTC::sync();
+	RTC::clearWakeup();
+	
+	// Recalc internal ticks counter, keep the sub-ms part for the next sleep
+	uint64_t elapsed = static_cast<uint64_t>(RTC::elapsed(start, RTC::ticks())) * 1000 + m_stop_remainder;
+	advance(elapsed / RTC::TICKS_PER_SECOND);
+	m_stop_remainder = elapsed % RTC::TICKS_PER_SECOND;
+	
+	// Restart systick
+	STK_CVR = 0;
+	systick_set_reload(m_counts_per_tick);
+	systick_counter_enable();
+	
+	// Enable irq
+	ENABLE_INTERRUPTS();
 }
 
 extern "C" void sys_tick_handler(void) {
@@ -3,21 +3,60 @@
 #include <cstdint>
 
 #include "Task.h"
+#include "Event.h"
+#include "Config.h"
 #include <delegate/delegate.hpp>
 
 class Loop {
 	public:
 		typedef delegate<bool(void *)> IdleCallback;
+		
+		struct Stats {
+			uint32_t iterations;
+			uint32_t wfi;
+			uint32_t idle;				// idleFor() sleeps
+			uint32_t stop;				// stopFor() sleeps
+			uint32_t events;			// dispatched events
+			uint32_t coalesced;			// tasks moved by their slack to share a later wakeup
+		};
 	
 	protected:
-		static Task *m_first;
-		static Task *m_last;
+		// Binary min-heap of the enabled tasks, ordered by Task::m_next_run
+		static Task *m_queue[Config::MAX_TASKS];
+		static uint32_t m_queue_size;
 		static uint32_t m_changed;
-		static int64_t m_last_log;
-		static volatile int64_t m_ticks;
+		static uint32_t m_last_log;
+		static volatile uint32_t m_ticks;
+		static volatile uint32_t m_ticks_hi;
+		static Stats m_stats;
+		static bool m_stop_allowed;
+		static volatile uint8_t m_stop_locks;
+		static uint32_t m_stop_remainder;
+		
+		// Events posted from ISR, drained at the start of each iteration
+		static Event *m_events[Config::MAX_EVENTS];
+		static uint32_t m_events_count;
+		static volatile bool m_events_pending;
 		
 		static IdleCallback m_idle_callback;
 		static void *m_idle_callback_data;
+		
+		static void dispatchEvents();
+		static uint32_t nextWakeup();
+		
+		static inline void advance(uint32_t ms) {
+			uint32_t ticks = m_ticks + ms;
+			if (ticks < m_ticks)
+				m_ticks_hi++;
+			m_ticks = ticks;
+		}
+		static void siftUp(uint32_t index);
+		static void siftDown(uint32_t index);
+		
+		static inline void place(uint32_t index, Task *task) {
+			m_queue[index] = task;
+			task->m_queue_index = index;
+		}
 	public:
 		static void init();
 		static void run();
@@ -28,40 +67,70 @@ class Loop {
 			m_idle_callback_data = data;
 		}
 		
-		static int64_t ms() {
+		// Monotonic ms, wraps every ~49.7 days, compare with timeDiff()/timeReached()
+		static inline uint32_t ms() {
 			return m_ticks;
 		}
 		
+		// Extended ms, for absolute timestamps
+		static uint64_t ms64();
+		
+		// Signed distance between two ms timestamps, valid while they are less than ~24.8 days apart
+		static inline int32_t timeDiff(uint32_t a, uint32_t b) {
+			return static_cast<int32_t>(a - b);
+		}
+		
+		static inline bool timeReached(uint32_t deadline) {
+			return timeDiff(ms(), deadline) >= 0;
+		}
+		
+		// Free-running microseconds, for measuring short intervals
+		static uint32_t us();
+		
+		static inline const Stats &stats() {
+			return m_stats;
+		}
+		
 		static uint32_t log() {
-			int64_t now = ms();
+			uint32_t now = ms();
 			uint32_t result = (m_last_log ? now - m_last_log : 0);
 			m_last_log = now;
 			return result;
 		}
 		
+		// Task with the nearest deadline
 		static inline Task *first() {
-			return m_first;
+			return m_queue_size ? m_queue[0] : nullptr;
 		}
 		
-		static inline void first(Task *task) {
-			m_first = task;
-		}
+		static bool schedule(Task *task);
+		static void reschedule(Task *task);
+		static void unschedule(Task *task);
 		
-		static inline Task *last() {
-			return m_last;
+		static inline void tick() {
+			if (!++m_ticks)
+				m_ticks_hi++;
 		}
 		
-		static inline void last(Task *task) {
-			m_last = task;
+		static inline void onChange() {
+			m_changed++;
 		}
 		
-		static inline void tick() {
-			m_ticks++;
+		static bool addEvent(Event *event);
+		
+		static inline void onEvent() {
+			m_events_pending = true;
 		}
 		
-		static inline void onChange() {
-			m_changed++;
+		// Peripherals which need clocks in sleep (TIM14) must disallow STOP
+		static inline void allowStop(bool flag) {
+			m_stop_allowed = flag;
 		}
 		
+		// Drivers hold off STOP while their peripherals are busy (ADC scan, I2C transfer), also from ISR
+		static void lockStop();
+		static void unlockStop();
+		
 		static void idleFor(uint32_t idle_time);
+		static void stopFor(uint32_t idle_time);
 };
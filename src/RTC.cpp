@@ -82,7 +82,7 @@ void RTC::setDateTime(int y, int m, int d, int hh, int mm, int ss) {
 	lock();
 }
 
-void RTC::setAlarm(int hh, int mm, int ss, int wday) {
+void RTC::setAlarm(int hh, int mm, int ss, int day) {
 	unlock();
 	
 	RTC_CR &= ~RTC_CR_ALRAE;
@@ -90,8 +90,8 @@ void RTC::setAlarm(int hh, int mm, int ss, int wday) {
 	
 	uint32_t reg = 0;
 	
-	if (wday >= 0) {
-		reg |= encodeBCD(wday, RTC_ALRMXR_DT_SHIFT, RTC_ALRMXR_DT_MASK, RTC_ALRMXR_DU_SHIFT, RTC_ALRMXR_DU_MASK);
+	if (day >= 0) {
+		reg |= encodeBCD(day, RTC_ALRMXR_DT_SHIFT, RTC_ALRMXR_DT_MASK, RTC_ALRMXR_DU_SHIFT, RTC_ALRMXR_DU_MASK);
 	} else {
 		reg |= RTC_ALRMXR_MSK4;
 	}
@@ -109,12 +109,17 @@ void RTC::setAlarm(int hh, int mm, int ss, int wday) {
 	}
 	
 	if (ss >= 0) {
-		reg |= encodeBCD(ss, RTC_ALRMXR_MNT_SHIFT, RTC_ALRMXR_ST_SHIFT, RTC_ALRMXR_SU_SHIFT, RTC_ALRMXR_SU_MASK);
+		reg |= encodeBCD(ss, RTC_ALRMXR_ST_SHIFT, RTC_ALRMXR_ST_MASK, RTC_ALRMXR_SU_SHIFT, RTC_ALRMXR_SU_MASK);
 	} else {
 		reg |= RTC_ALRMXR_MSK1;
 	}
 	
 	RTC_ALRMAR = reg;
+	RTC_ALRMASSR = 0;
+	
+	// STANDBY is only left on a new alarm event
+	RTC_ISR &= ~RTC_ISR_ALRAF;
+	exti_reset_request(EXTI17);
 	
 	RTC_CR |= RTC_CR_ALRAE;
 	
@@ -128,6 +133,58 @@ void RTC::clearAlarm() {
 	lock();
 }
 
+uint32_t RTC::ticks() {
+	// Reading SSR locks TR and DR until DR is read
+	uint32_t ssr = RTC_SSR;
+	uint32_t tr = RTC_TR;
+	(void) RTC_DR;
+	
+	uint32_t seconds = (
+		decodeBCD(tr, RTC_TR_HT_SHIFT, RTC_TR_HT_MASK, RTC_TR_HU_SHIFT, RTC_TR_HU_MASK) * 3600 +
+		decodeBCD(tr, RTC_TR_MNT_SHIFT, RTC_TR_MNT_MASK, RTC_TR_MNU_SHIFT, RTC_TR_MNU_MASK) * 60 +
+		decodeBCD(tr, RTC_TR_ST_SHIFT, RTC_TR_ST_MASK, RTC_TR_SU_SHIFT, RTC_TR_SU_MASK)
+	);
+	return seconds * TICKS_PER_SECOND + (Config::RTC_PRESCALER_S - ssr);
+}
+
+void RTC::sync() {
+	// Shadow registers are stale after STOP
+	pwr_disable_backup_domain_write_protect();
+	rtc_wait_for_synchro();
+	pwr_enable_backup_domain_write_protect();
+}
+
+void RTC::setWakeup(uint32_t ticks) {
+	ticks %= TICKS_PER_DAY;
+	
+	uint32_t seconds = ticks / TICKS_PER_SECOND;
+	uint32_t subseconds = Config::RTC_PRESCALER_S - ticks % TICKS_PER_SECOND;
+	
+	unlock();
+	
+	RTC_CR &= ~RTC_CR_ALRAE;
+	while (!(RTC_ISR & RTC_ISR_ALRAWF));
+	
+	RTC_ALRMAR = (
+		RTC_ALRMXR_MSK4 |
+		encodeBCD(seconds / 3600, RTC_ALRMXR_HT_SHIFT, RTC_ALRMXR_HT_MASK, RTC_ALRMXR_HU_SHIFT, RTC_ALRMXR_HU_MASK) |
+		encodeBCD(seconds / 60 % 60, RTC_ALRMXR_MNT_SHIFT, RTC_ALRMXR_MNT_MASK, RTC_ALRMXR_MNU_SHIFT, RTC_ALRMXR_MNU_MASK) |
+		encodeBCD(seconds % 60, RTC_ALRMXR_ST_SHIFT, RTC_ALRMXR_ST_MASK, RTC_ALRMXR_SU_SHIFT, RTC_ALRMXR_SU_MASK)
+	);
+	RTC_ALRMASSR = (15 << RTC_ALRMXSSR_MASKSS_SHIFT) | (subseconds << RTC_ALRMXSSR_SS_SHIFT);
+	
+	RTC_ISR &= ~RTC_ISR_ALRAF;
+	exti_reset_request(EXTI17);
+	
+	RTC_CR |= RTC_CR_ALRAE;
+	
+	lock();
+}
+
+void RTC::clearWakeup() {
+	clearAlarm();
+}
+
 // https://blog.reverberate.org/2020/05/12/optimizing-date-algorithms.html
 uint32_t RTC::toUnixTime(int year, int month, int day, int hours, int minutes, int seconds) {
 	static const uint16_t month_yday[12] = {0, 31, 59, 90, 120, 151, 181, 212, 243, 273, 304, 334};
@@ -2,6 +2,8 @@
 
 #include <cstdint>
 
+#include "Config.h"
+
 class RTC {
 	public:
 		struct tm {
@@ -14,6 +16,10 @@ class RTC {
 		};
 		
 		static constexpr int ALARM_ANY = -1;
+		
+		// Subsecond counter runs at ck_apre
+		static constexpr uint32_t TICKS_PER_SECOND = Config::RTC_PRESCALER_S + 1;
+		static constexpr uint32_t TICKS_PER_DAY = TICKS_PER_SECOND * 24 * 3600;
 	
 	protected:
 		static void lock();
@@ -38,6 +44,19 @@ class RTC {
 		
 		static bool fromUnixTime(uint32_t t, tm *result);
 		
-		static void setAlarm(int hh = ALARM_ANY, int mm = ALARM_ANY, int ss = ALARM_ANY, int wday = ALARM_ANY);
+		// Time of day in subsecond ticks
+		static uint32_t ticks();
+		static void sync();
+		
+		static inline uint32_t elapsed(uint32_t from, uint32_t to) {
+			return to >= from ? to - from : TICKS_PER_DAY - from + to;
+		}
+		
+		// Alarm A at the time of day, with subsecond precision (for waking up from STOP)
+		static void setWakeup(uint32_t ticks);
+		static void clearWakeup();
+		
+		// Alarm A at the time of the day of month, wakes up from STANDBY
+		static void setAlarm(int hh = ALARM_ANY, int mm = ALARM_ANY, int ss = ALARM_ANY, int day = ALARM_ANY);
 		static void clearAlarm();
 };
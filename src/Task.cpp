@@ -2,7 +2,12 @@
 #include "Task.h"
 #include "utils.h"
 
+#include <algorithm>
+
 void Task::exec() {
+	uint32_t lateness = Loop::ms() - m_next_run;
+	uint32_t start = Loop::us();
+	
 	if (!m_loop)
 		cancel();
 	
@@ -11,30 +16,28 @@ void Task::exec() {
 	
 	if (m_loop)
 		run(m_interval, true);
+	
+	uint32_t elapsed = Loop::us() - start;
+	m_stats.runs++;
+	m_stats.total_time += elapsed;
+	m_stats.max_time = std::max(m_stats.max_time, elapsed);
+	m_stats.max_lateness = std::max(m_stats.max_lateness, lateness);
 }
 
 void Task::run(uint32_t ms, bool loop) {
 	ENTER_CRITICAL();
 	
-	if (m_enabled)
-		cancel();
-	
 	m_interval = ms;
 	m_next_run = Loop::ms() + ms;
 	m_loop = loop;
 	
-	if (!Loop::last()) {
-		Loop::first(this);
-		Loop::last(this);
+	if (m_enabled) {
+		// Already queued, only move to the new position
+		Loop::reschedule(this);
 	} else {
-		Loop::last()->m_next = this;
-		m_prev = Loop::last();
-		m_next = nullptr;
-		Loop::last(this);
+		m_enabled = Loop::schedule(this);
 	}
 	
-	m_enabled = true;
-	
 	Loop::onChange();
 	
 	EXIT_CRITICAL();
@@ -48,21 +51,7 @@ void Task::cancel() {
 		return;
 	}
 	
-	if (this == Loop::first())
-		Loop::first(m_next);
-	
-	if (this == Loop::last())
-		Loop::last(m_prev);
-	
-	if (m_prev)
-		m_prev->m_next = m_next;
-	
-	if (m_next)
-		m_next->m_prev = m_prev;
-	
-	m_prev = nullptr;
-	m_next = nullptr;
-	
+	Loop::unschedule(this);
 	m_enabled = false;
 	
 	Loop::onChange();
@@ -6,16 +6,26 @@
 class Task {
 	public:
 		typedef delegate<void(void *)> Callback;
+		
+		static constexpr uint8_t NOT_QUEUED = 0xFF;
+		
+		struct Stats {
+			uint32_t runs;
+			uint32_t total_time;		// us
+			uint32_t max_time;			// us
+			uint32_t max_lateness;		// ms
+		};
 	
 	protected:
 		Callback m_callback;
 		void *m_user_data = nullptr;
-		Task *m_next = nullptr;
-		Task *m_prev = nullptr;
+		uint8_t m_queue_index = NOT_QUEUED;
 		bool m_loop = false;
 		bool m_enabled = false;
-		int64_t m_next_run = 0;
+		uint32_t m_next_run = 0;
 		uint32_t m_interval = 0;
+		uint32_t m_slack = 0;
+		Stats m_stats = {};
 		
 		friend class Loop;
 	public:
@@ -29,16 +39,12 @@ class Task {
 			return m_enabled;
 		}
 		
-		inline int64_t nextRun() {
+		inline uint32_t nextRun() {
 			return m_next_run;
 		}
 		
-		inline Task *prev() {
-			return m_prev;
-		}
-		
-		inline Task *next() {
-			return m_next;
+		inline const Stats &stats() {
+			return m_stats;
 		}
 		
 		inline void init(Callback callback, void *user_data = nullptr) {
@@ -56,5 +62,10 @@ class Task {
 			run(ms, true);
 		}
 		
+		// Allow running up to `ms` later, so Loop can serve it with the wakeup of another task
+		inline void setSlack(uint32_t ms) {
+			m_slack = ms;
+		}
+		
 		void cancel();
 };
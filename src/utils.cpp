@@ -44,8 +44,8 @@ void uart_simple_setup(uint32_t usart, uint32_t baudrate, bool use_for_printf) {
 void ENTER_CRITICAL(void) {
     DISABLE_INTERRUPTS();
     critical_nesting++;
-    __asm__ volatile ("dsb" ::: "memory");
-    __asm__ volatile ("isb");
+    DATA_SYNC_BARRIER();
+    INSTRUCTION_SYNC_BARRIER();
 }
 
 void EXIT_CRITICAL(void) {
@@ -55,6 +55,7 @@ void EXIT_CRITICAL(void) {
 		ENABLE_INTERRUPTS();
 }
 
+#ifndef HOST_BUILD
 extern "C"
 __attribute__((used))
 void putchar_(char c) {
@@ -101,3 +102,4 @@ __attribute__((used))
 void __cxa_guard_release(void *g) {
 	
 }
+#endif
@@ -4,8 +4,15 @@
 
 #define COUNT_OF(array) (sizeof(array) / sizeof(array[0]))
 
-#define DISABLE_INTERRUPTS()	__asm__ volatile ( " cpsid i " ::: "memory" )
-#define ENABLE_INTERRUPTS()		__asm__ volatile ( " cpsie i " ::: "memory" )
+#ifdef HOST_BUILD
+#include <Sim.h>
+#else
+#define DISABLE_INTERRUPTS()			__asm__ volatile ( " cpsid i " ::: "memory" )
+#define ENABLE_INTERRUPTS()				__asm__ volatile ( " cpsie i " ::: "memory" )
+#define WAIT_FOR_INTERRUPT()			__asm__ volatile ( " wfi " )
+#define DATA_SYNC_BARRIER()				__asm__ volatile ( " dsb " ::: "memory" )
+#define INSTRUCTION_SYNC_BARRIER()		__asm__ volatile ( " isb " )
+#endif
 
 int idec(int v, int n = 3);
 int iexp(int v, int n = 3);